@@ -0,0 +1,54 @@
+#include "pch.h"
+#include "AdaptiveFrameRate.h"
+
+#include <cmath>
+
+using namespace std;
+
+AdaptiveFrameRate::AdaptiveFrameRate(double maxFrameRate, double minFrameRate)
+	: maxFrameRate(maxFrameRate), minFrameRate(minFrameRate), frameRate(maxFrameRate)
+{
+}
+
+void AdaptiveFrameRate::SetMaxFrameRate(double frameRate)
+{
+	maxFrameRate = frameRate;
+}
+
+void AdaptiveFrameRate::SetMinFrameRate(double frameRate)
+{
+	minFrameRate = frameRate;
+}
+
+double AdaptiveFrameRate::Update(int64_t timeNs, double changedTiles, hr_clock::duration encodeTime, size_t queueDepth, size_t queueCapacity)
+{
+	auto maxRate = maxFrameRate.load(memory_order_relaxed), minRate = minFrameRate.load(memory_order_relaxed);
+	if (maxRate <= 0)
+		return 0;
+	if (minRate <= 0 || minRate >= maxRate)
+		return frameRate = maxRate;
+
+	// smoothed over time rather than frames, the frames come in at the very rate being adapted. A long idle
+	// stretch counts as a few seconds, enough to decay all the way
+	auto seconds = lastFrameTimeNs == INT64_MIN ? 1 / maxRate : clamp((timeNs - lastFrameTimeNs) / 1e9, 0.0, 10.0);
+	lastFrameTimeNs = timeNs;
+	auto smooth = [seconds](double& value, double target, double timeConstant) {
+		value += (target - value) * (1 - exp(-seconds / timeConstant));
+		};
+
+	auto motion = min(changedTiles / ADAPTIVE_FULL_MOTION_CHANGE, 1.0);
+	smooth(activity, motion, motion > activity ? ADAPTIVE_ATTACK_SECONDS : ADAPTIVE_DECAY_SECONDS);
+	auto target = minRate + (maxRate - minRate) * activity;
+
+	// what the encoder can sustain, less the more frames are already waiting for it
+	auto frameEncodeSeconds = chrono::duration<double>(encodeTime).count();
+	encodeSeconds = encodeSeconds ? encodeSeconds + (frameEncodeSeconds - encodeSeconds) * 0.1 : frameEncodeSeconds;
+	if (encodeSeconds > 0)
+	{
+		auto backlog = queueCapacity ? min(static_cast<double>(queueDepth) / queueCapacity, 1.0) : 0;
+		target = min(target, ADAPTIVE_ENCODER_UTILIZATION / encodeSeconds * (1 - backlog));
+	}
+
+	smooth(frameRate, clamp(target, minRate, maxRate), ADAPTIVE_RATE_SECONDS);
+	return frameRate = clamp(frameRate, minRate, maxRate);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+constexpr double DEFAULT_MIN_FRAME_RATE = 2;
+
+// the share of the tiles changing in a frame that counts as full motion, typing or a blinking cursor is well under it
+constexpr double ADAPTIVE_FULL_MOTION_CHANGE = 0.05;
+// how fast the content's activity rises with motion and decays once the window is idle, in seconds
+constexpr double ADAPTIVE_ATTACK_SECONDS = 0.1;
+constexpr double ADAPTIVE_DECAY_SECONDS = 2;
+// how fast the frame rate follows its target, so load is shed over a few frames instead of all at once
+constexpr double ADAPTIVE_RATE_SECONDS = 0.25;
+// the share of the encoder's time the frames may take, the rest absorbs the spikes
+constexpr double ADAPTIVE_ENCODER_UTILIZATION = 0.8;
+
+// picks the rate frames are admitted at, between a floor and a ceiling. Motion raises it quickly towards the ceiling
+// and it decays slowly back to the floor once the window is idle. An encoder slower than the frame rate, or frames
+// backing up in the queue, bring it down gradually so frames are shed evenly instead of dropped at random by a full
+// queue. Updated from the frame processing thread, the limits can be set from any thread
+class AdaptiveFrameRate final
+{
+	std::atomic<double> maxFrameRate, minFrameRate;
+	double frameRate{};
+	double activity{};			// 0 for an idle window to 1 for full motion
+	double encodeSeconds{};		// per frame
+	int64_t lastFrameTimeNs{ INT64_MIN };
+
+public:
+	AdaptiveFrameRate(double maxFrameRate, double minFrameRate = DEFAULT_MIN_FRAME_RATE);
+
+	// 0 or less turns the limit off, and with it the adaptation
+	void SetMaxFrameRate(double);
+	// 0 or less, or at least the ceiling, keeps the frame rate at the ceiling
+	void SetMinFrameRate(double);
+
+	// after every encoded frame, with the share of its tiles that changed and the frames still waiting to be encoded.
+	// Returns the rate to admit frames at from now on, 0 for no limit
+	double Update(int64_t timeNs, double changedTiles, hr_clock::duration encodeTime, size_t queueDepth, size_t queueCapacity);
+};
@@ -0,0 +1,243 @@
+#include "pch.h"
+#include "AsyncFileWriter.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+AsyncFileWriter::AsyncFileWriter(const filesystem::path& path, const ErrorFunc errorFunc, size_t bufferBudget)
+	: errorFunc(errorFunc)
+{
+#ifdef _WIN32
+	file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		errorFunc(HRESULT_FROM_WIN32(GetLastError()));
+		failed = true;
+		return;
+	}
+#else
+	file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+	{
+		errorFunc(E_FAIL);
+		failed = true;
+		return;
+	}
+#endif
+
+	Open(bufferBudget);
+}
+
+AsyncFileWriter::AsyncFileWriter(std::unique_ptr<std::ostream> ostream, const ErrorFunc errorFunc, size_t bufferBudget)
+	: errorFunc(errorFunc), ostream(move(ostream))
+{
+	Open(bufferBudget);
+}
+
+void AsyncFileWriter::Open(size_t bufferBudget)
+{
+	// at least two chunks, so one can be filled while the other is written
+	chunkCount = max<size_t>(bufferBudget / ASYNC_WRITE_CHUNK_SIZE, 2);
+	buffer.resize(chunkCount * ASYNC_WRITE_CHUNK_SIZE);
+	chunkSizes.resize(chunkCount);
+	chunkSyncs.resize(chunkCount);
+
+	thread = std::thread([this] { WriteChunks(); });
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	if (thread.joinable())
+	{
+		if (chunkUsed)
+			PublishChunk();
+		published.fetch_or(1, memory_order_release);
+		published.notify_one();
+		thread.join();
+		CheckWriteError();
+	}
+
+	if (ostream)
+		ostream->flush();
+#ifdef _WIN32
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+#else
+	if (file >= 0)
+		close(file);
+#endif
+}
+
+void AsyncFileWriter::Write(span<const BYTE> data)
+{
+	if (failed || CheckWriteError())
+		return;
+
+	while (!data.empty())
+	{
+		// the next chunk must have been written out before it's reused, which is the only time this waits
+		if (!chunkUsed && !WaitForFreeChunk())
+			return;
+
+		auto chunk = buffer.data() + filledChunks % chunkCount * ASYNC_WRITE_CHUNK_SIZE;
+		auto size = min(data.size(), ASYNC_WRITE_CHUNK_SIZE - chunkUsed);
+		memcpy(chunk + chunkUsed, data.data(), size);
+		chunkUsed += size;
+		data = data.subspan(size);
+
+		if (chunkUsed == ASYNC_WRITE_CHUNK_SIZE)
+			PublishChunk();
+	}
+}
+
+void AsyncFileWriter::Flush()
+{
+	if (failed || !thread.joinable())
+		return;
+
+	if (chunkUsed)
+		PublishChunk();
+	for (auto written = writtenChunks.load(memory_order_acquire); written != filledChunks && !CheckWriteError();
+		written = writtenChunks.load(memory_order_acquire))
+		writtenChunks.wait(written, memory_order_acquire);
+
+	if (ostream)
+		ostream->flush();
+}
+
+void AsyncFileWriter::Sync()
+{
+	if (failed || !thread.joinable())
+		return;
+
+	// an empty chunk if the last one was just filled, the sync has to follow the data it covers
+	if (!chunkUsed && !WaitForFreeChunk())
+		return;
+	PublishChunk(true);
+}
+
+bool AsyncFileWriter::WaitForFreeChunk()
+{
+	for (auto written = writtenChunks.load(memory_order_acquire); filledChunks - written >= chunkCount;
+		written = writtenChunks.load(memory_order_acquire))
+	{
+		if (CheckWriteError())
+			return false;
+		writtenChunks.wait(written, memory_order_acquire);
+	}
+	return true;
+}
+
+void AsyncFileWriter::PublishChunk(bool sync)
+{
+	chunkSizes[filledChunks % chunkCount] = chunkUsed;
+	chunkSyncs[filledChunks % chunkCount] = sync;
+	++filledChunks;
+	chunkUsed = 0;
+
+	published.fetch_add(2, memory_order_release);
+	published.notify_one();
+}
+
+bool AsyncFileWriter::CheckWriteError()
+{
+	// reported once, from the caller's thread, and nothing is written after it
+	auto hr = writeError.load(memory_order_acquire);
+	if (SUCCEEDED(hr))
+		return false;
+
+	if (!failed)
+	{
+		failed = true;
+		errorFunc(hr);
+	}
+	return true;
+}
+
+void AsyncFileWriter::WriteChunks()
+{
+	uint64_t written = 0;
+	for (;;)
+	{
+		auto state = published.load(memory_order_acquire);
+		auto filled = state >> 1;
+		if (written == filled)
+		{
+			if (state & 1)
+				return;
+			published.wait(state, memory_order_acquire);
+			continue;
+		}
+
+		// the filled chunks that follow each other in the buffer go out in a single write, a partial chunk ends it
+		auto firstChunk = written % chunkCount;
+		size_t chunks = 0, size = 0;
+		while (written + chunks < filled && firstChunk + chunks < chunkCount)
+		{
+			auto chunkSize = chunkSizes[firstChunk + chunks++];
+			size += chunkSize;
+			if (chunkSize != ASYNC_WRITE_CHUNK_SIZE)
+				break;
+		}
+
+		// a chunk to sync is never full, so it's always the last one of the write
+		if (!WriteToFile(buffer.data() + firstChunk * ASYNC_WRITE_CHUNK_SIZE, size)
+			|| (chunkSyncs[firstChunk + chunks - 1] && !SyncFile()))
+		{
+			// the caller reports it, and stops waiting for chunks that will never be written
+			writeError.store(E_FAIL, memory_order_release);
+			writtenChunks.store(UINT64_MAX, memory_order_release);
+			writtenChunks.notify_one();
+			return;
+		}
+
+		written += chunks;
+		writtenChunks.store(written, memory_order_release);
+		writtenChunks.notify_one();
+	}
+}
+
+bool AsyncFileWriter::WriteToFile(const BYTE* data, size_t size)
+{
+	if (ostream)
+	{
+		ostream->write(reinterpret_cast<const char*>(data), static_cast<streamsize>(size));
+		return ostream->good();
+	}
+
+	while (size)
+	{
+#ifdef _WIN32
+		DWORD bytesWritten{};
+		if (!WriteFile(file, data, static_cast<DWORD>(min<size_t>(size, 1u << 30)), &bytesWritten, nullptr))
+			return false;
+#else
+		auto bytesWritten = ::write(file, data, size);
+		if (bytesWritten < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+#endif
+		data += bytesWritten;
+		size -= static_cast<size_t>(bytesWritten);
+	}
+	return true;
+}
+
+bool AsyncFileWriter::SyncFile()
+{
+	if (ostream)
+		return ostream->flush().good();
+
+#ifdef _WIN32
+	return FlushFileBuffers(file);
+#else
+	return fdatasync(file) == 0;
+#endif
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+// the buffers are written in chunks of this size, several of them at once if they're queued back to back
+constexpr size_t ASYNC_WRITE_CHUNK_SIZE = 1024 * 1024;
+constexpr size_t ASYNC_WRITE_DEFAULT_BUDGET = 64 * 1024 * 1024;
+
+// writes a file from its own thread, so the caller only copies into memory. The data goes through a circular
+// buffer split into chunks, which the caller fills and hands to the writer thread through lock-free counters.
+// Write only blocks when every chunk is waiting to be written, that is once the buffer budget is exhausted
+class AsyncFileWriter final
+{
+	const ErrorFunc errorFunc;
+	std::unique_ptr<std::ostream> ostream;
+#ifdef _WIN32
+	HANDLE file{ INVALID_HANDLE_VALUE };
+#else
+	int file{ -1 };
+#endif
+
+	std::vector<BYTE> buffer;
+	std::vector<size_t> chunkSizes;		// of the filled chunks, the last one before a Flush or Sync can be partial
+	std::vector<BYTE> chunkSyncs;		// the file is flushed to disk once the chunk is written
+	size_t chunkCount{};
+
+	// filled chunks shifted left once, with the lowest bit set once the writer thread should stop. Both counters
+	// only grow, the chunk a counter points to is that counter modulo the chunk count
+	std::atomic<uint64_t> published{};
+	std::atomic<uint64_t> writtenChunks{};
+	std::atomic<HRESULT> writeError{ S_OK };
+
+	// the caller's side
+	uint64_t filledChunks{};
+	size_t chunkUsed{};
+	bool failed{};
+
+	std::thread thread;
+
+	void Open(size_t bufferBudget);
+	bool WaitForFreeChunk();
+	void PublishChunk(bool sync = false);
+	bool CheckWriteError();
+
+	// the writer thread's side
+	void WriteChunks();
+	bool WriteToFile(const BYTE* data, size_t size);
+	bool SyncFile();
+
+public:
+	// the file is created or truncated
+	AsyncFileWriter(const std::filesystem::path&, const ErrorFunc, size_t bufferBudget = ASYNC_WRITE_DEFAULT_BUDGET);
+	// the stream is written from the writer thread, and closed with the writer
+	AsyncFileWriter(std::unique_ptr<std::ostream>, const ErrorFunc, size_t bufferBudget = ASYNC_WRITE_DEFAULT_BUDGET);
+	// waits for everything to be written
+	~AsyncFileWriter();
+
+	AsyncFileWriter(const AsyncFileWriter&) = delete;
+	AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+	void Write(std::span<const BYTE>);
+
+	// waits for everything written so far to reach the file
+	void Flush();
+
+	// has the writer thread flush everything written so far past the OS cache to the disk once it's in the file,
+	// without waiting for it. Streams are only flushed
+	void Sync();
+};
@@ -0,0 +1,285 @@
+#include "pch.h"
+#include "ColorConverter.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <cmath>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2_F16C
+#else
+#define TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#endif
+
+using namespace std;
+
+namespace
+{
+	// 8 bit fixed point, the sums stay in 16 bits unsigned so the vector code can use them as-is
+	inline BYTE ToY(int r, int g, int b) { return static_cast<BYTE>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16); }
+	inline BYTE ToU(int r, int g, int b) { return static_cast<BYTE>((112 * b - 38 * r - 74 * g + 128 + (128 << 8)) >> 8); }
+	inline BYTE ToV(int r, int g, int b) { return static_cast<BYTE>((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8); }
+
+	inline __m128i Channel(__m128i pixels, int shift)
+	{
+		return _mm_and_si128(_mm_srli_epi32(pixels, shift), _mm_set1_epi32(0xFF));
+	}
+
+	// the sums of the 2x2 blocks of 4 pixels from each row, as 32 bit lanes
+	inline __m128i SumBlocks(__m128i top0, __m128i bottom0, __m128i top1, __m128i bottom1)
+	{
+		auto sum0 = _mm_add_epi32(top0, bottom0), sum1 = _mm_add_epi32(top1, bottom1);
+		sum0 = _mm_add_epi32(sum0, _mm_srli_epi64(sum0, 32));
+		sum1 = _mm_add_epi32(sum1, _mm_srli_epi64(sum1, 32));
+		return _mm_unpacklo_epi64(_mm_shuffle_epi32(sum0, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(sum1, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	inline __m128i Average(__m128i sums)
+	{
+		auto average = _mm_srli_epi32(_mm_add_epi32(sums, _mm_set1_epi32(2)), 2);
+		return _mm_packs_epi32(average, average);
+	}
+
+	inline __m128i Multiply(__m128i value, short factor)
+	{
+		return _mm_mullo_epi16(value, _mm_set1_epi16(factor));
+	}
+
+	// 8 pixels of two rows: 8 luma values for each row and 4 interleaved chroma pairs
+	inline void Convert8(const BYTE* top, const BYTE* bottom, BYTE* topY, BYTE* bottomY, BYTE* uv)
+	{
+		auto top0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top));
+		auto top1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + 16));
+		auto bottom0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom));
+		auto bottom1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + 16));
+
+		auto luma = [](__m128i pixels0, __m128i pixels1) {
+			auto b = _mm_packs_epi32(Channel(pixels0, 0), Channel(pixels1, 0));
+			auto g = _mm_packs_epi32(Channel(pixels0, 8), Channel(pixels1, 8));
+			auto r = _mm_packs_epi32(Channel(pixels0, 16), Channel(pixels1, 16));
+			auto y = _mm_add_epi16(_mm_add_epi16(Multiply(r, 66), Multiply(g, 129)), _mm_add_epi16(Multiply(b, 25), _mm_set1_epi16(128)));
+			y = _mm_add_epi16(_mm_srli_epi16(y, 8), _mm_set1_epi16(16));
+			return _mm_packus_epi16(y, y);
+			};
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(topY), luma(top0, top1));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(bottomY), luma(bottom0, bottom1));
+
+		auto b = Average(SumBlocks(Channel(top0, 0), Channel(bottom0, 0), Channel(top1, 0), Channel(bottom1, 0)));
+		auto g = Average(SumBlocks(Channel(top0, 8), Channel(bottom0, 8), Channel(top1, 8), Channel(bottom1, 8)));
+		auto r = Average(SumBlocks(Channel(top0, 16), Channel(bottom0, 16), Channel(top1, 16), Channel(bottom1, 16)));
+		auto bias = _mm_set1_epi16(static_cast<short>(128 + (128 << 8)));
+		auto u = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(Multiply(b, 112), _mm_add_epi16(Multiply(r, 38), Multiply(g, 74))), bias), 8);
+		auto v = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(Multiply(r, 112), _mm_add_epi16(Multiply(g, 94), Multiply(b, 18))), bias), 8);
+		auto uvWords = _mm_unpacklo_epi16(u, v);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(uv), _mm_packus_epi16(uvWords, uvWords));
+	}
+
+	// the tone curve is the identity up to the knee, and compresses everything above it into what's left up to 1
+	constexpr float TONE_MAP_KNEE = 0.8f;
+	// the sRGB encoding of the tone mapped channels, quantized finely enough that each step is at most one 8 bit level
+	constexpr int SRGB_TABLE_SIZE = 4096;
+
+	const array<int32_t, SRGB_TABLE_SIZE>& GetSrgbTable()
+	{
+		static const auto table = [] {
+			array<int32_t, SRGB_TABLE_SIZE> table{};
+			for (int i = 0; i < SRGB_TABLE_SIZE; ++i)
+			{
+				auto linear = static_cast<double>(i) / (SRGB_TABLE_SIZE - 1);
+				auto srgb = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1 / 2.4) - 0.055;
+				table[i] = static_cast<int32_t>(srgb * 255 + 0.5);
+			}
+			return table;
+			}();
+		return table;
+	}
+
+	float HalfToFloat(uint16_t half)
+	{
+		uint32_t sign = (half & 0x8000u) << 16, exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FFu;
+		uint32_t bits;
+		if (exponent == 0x1F)
+			bits = sign | 0x7F800000u | (mantissa << 13);		// infinity and NaN
+		else if (exponent)
+			bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		else if (mantissa)
+		{
+			// denormals are normalized
+			exponent = 113;
+			while (!(mantissa & 0x400u))
+			{
+				mantissa <<= 1;
+				--exponent;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FFu) << 13);
+		}
+		else
+			bits = sign;
+
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	// the index of the channel in the sRGB table, negative values go to black, infinity and NaN to white
+	inline int ToneMap(float value)
+	{
+		if (value > TONE_MAP_KNEE)
+		{
+			auto excess = value - TONE_MAP_KNEE;
+			value = TONE_MAP_KNEE + (1 - TONE_MAP_KNEE) * excess / (excess + (1 - TONE_MAP_KNEE));
+		}
+		value = value < 1 ? value : 1;
+		value = value > 0 ? value : 0;
+		return static_cast<int>(value * (SRGB_TABLE_SIZE - 1) + 0.5f);
+	}
+
+	void ToneMapRow(const uint16_t* rgba, BYTE* bgra, int width, const int32_t* srgbTable)
+	{
+		for (int x = 0; x < width; ++x, rgba += 4, bgra += 4)
+		{
+			bgra[0] = static_cast<BYTE>(srgbTable[ToneMap(HalfToFloat(rgba[2]))]);
+			bgra[1] = static_cast<BYTE>(srgbTable[ToneMap(HalfToFloat(rgba[1]))]);
+			bgra[2] = static_cast<BYTE>(srgbTable[ToneMap(HalfToFloat(rgba[0]))]);
+			bgra[3] = 0xFF;
+		}
+	}
+
+	// 2 pixels, the same operations in the same order as ToneMap so both give the same bytes
+	TARGET_AVX2_F16C inline __m256i ToneMap2(const uint16_t* rgba, const int32_t* srgbTable)
+	{
+		auto value = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba)));
+		auto knee = _mm256_set1_ps(TONE_MAP_KNEE), range = _mm256_set1_ps(1 - TONE_MAP_KNEE);
+		auto excess = _mm256_sub_ps(value, knee);
+		auto shoulder = _mm256_add_ps(knee, _mm256_div_ps(_mm256_mul_ps(range, excess), _mm256_add_ps(excess, range)));
+		value = _mm256_blendv_ps(value, shoulder, _mm256_cmp_ps(value, knee, _CMP_GT_OQ));
+		// min and max return their second operand for NaN
+		value = _mm256_min_ps(value, _mm256_set1_ps(1));
+		value = _mm256_max_ps(value, _mm256_setzero_ps());
+		auto index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(value, _mm256_set1_ps(SRGB_TABLE_SIZE - 1)), _mm256_set1_ps(0.5f)));
+		return _mm256_i32gather_epi32(srgbTable, index, 4);
+	}
+
+	TARGET_AVX2_F16C void ToneMapRowAvx2(const uint16_t* rgba, BYTE* bgra, int width, const int32_t* srgbTable)
+	{
+		// RGBA to BGRA in every pixel, and the pixels back in order after the packs interleaved the two halves
+		auto swapRedBlue = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+			2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+		auto pixelOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		auto opaque = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+
+		int x = 0;
+		for (; x + 8 <= width; x += 8)
+		{
+			auto pixels01 = ToneMap2(rgba + x * 4, srgbTable), pixels23 = ToneMap2(rgba + x * 4 + 8, srgbTable);
+			auto pixels45 = ToneMap2(rgba + x * 4 + 16, srgbTable), pixels67 = ToneMap2(rgba + x * 4 + 24, srgbTable);
+			auto bytes = _mm256_packus_epi16(_mm256_packus_epi32(pixels01, pixels23), _mm256_packus_epi32(pixels45, pixels67));
+			bytes = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(bytes, pixelOrder), swapRedBlue);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(bgra + x * 4), _mm256_or_si256(bytes, opaque));
+		}
+
+		ToneMapRow(rgba + x * 4, bgra + x * 4, width - x, srgbTable);
+	}
+
+	bool HasAvx2F16c()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		auto f16c = (info[2] & (1 << 29)) != 0, osxsave = (info[2] & (1 << 27)) != 0;
+		__cpuidex(info, 7, 0);
+		auto avx2 = (info[1] & (1 << 5)) != 0;
+		// the OS must save the AVX registers too
+		return f16c && avx2 && osxsave && (_xgetbv(0) & 6) == 6;
+#else
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+#endif
+	}
+}
+
+void ConvertBgraToNv12(const BYTE* bgra, ptrdiff_t stride, int width, int height,
+	BYTE* nv12, int nv12Width, int nv12Height, int firstRow, int endRow)
+{
+	assert(firstRow % 2 == 0 && endRow % 2 == 0 && nv12Width % 2 == 0 && nv12Height % 2 == 0);
+
+	auto vectorWidth = min(width, nv12Width) / 8 * 8;
+	auto uvPlane = nv12 + static_cast<size_t>(nv12Width) * nv12Height;
+
+	for (auto y = firstRow; y < endRow; y += 2)
+	{
+		auto top = bgra + min(y, height - 1) * stride;
+		auto bottom = bgra + min(y + 1, height - 1) * stride;
+		auto topY = nv12 + static_cast<size_t>(y) * nv12Width;
+		auto bottomY = topY + nv12Width;
+		auto uv = uvPlane + static_cast<size_t>(y / 2) * nv12Width;
+
+		int x = 0;
+		for (; x < vectorWidth; x += 8)
+			Convert8(top + x * 4, bottom + x * 4, topY + x, bottomY + x, uv + x);
+
+		// the rest of the row, and the padding past the source
+		for (; x < nv12Width; x += 2)
+		{
+			const BYTE* block[4]{ top + min(x, width - 1) * 4, top + min(x + 1, width - 1) * 4,
+				bottom + min(x, width - 1) * 4, bottom + min(x + 1, width - 1) * 4 };
+
+			topY[x] = ToY(block[0][2], block[0][1], block[0][0]);
+			topY[x + 1] = ToY(block[1][2], block[1][1], block[1][0]);
+			bottomY[x] = ToY(block[2][2], block[2][1], block[2][0]);
+			bottomY[x + 1] = ToY(block[3][2], block[3][1], block[3][0]);
+
+			int b{}, g{}, r{};
+			for (auto pixel : block)
+			{
+				b += pixel[0];
+				g += pixel[1];
+				r += pixel[2];
+			}
+			b = (b + 2) >> 2;
+			g = (g + 2) >> 2;
+			r = (r + 2) >> 2;
+			uv[x] = ToU(r, g, b);
+			uv[x + 1] = ToV(r, g, b);
+		}
+	}
+}
+
+void ToneMapHalfToBgra(const BYTE* rgbaHalf, ptrdiff_t stride, int width, BYTE* bgra, int firstRow, int endRow)
+{
+	static const auto avx2 = HasAvx2F16c();
+	auto srgbTable = GetSrgbTable().data();
+
+	for (auto y = firstRow; y < endRow; ++y)
+	{
+		auto source = reinterpret_cast<const uint16_t*>(rgbaHalf + y * stride);
+		auto destination = bgra + static_cast<size_t>(y) * width * 4;
+		if (avx2)
+			ToneMapRowAvx2(source, destination, width, srgbTable);
+		else
+			ToneMapRow(source, destination, width, srgbTable);
+	}
+}
+
+void ConvertNv12ToBgra(const BYTE* nv12, int width, int height, BYTE* bgra, int firstRow, int endRow)
+{
+	// 16 bit fixed point BT.601 limited range, only used to look at diaries so it's kept simple
+	auto clampByte = [](int value) { return static_cast<BYTE>(clamp(value >> 16, 0, 255)); };
+	auto uvPlane = nv12 + static_cast<size_t>(width) * height;
+
+	for (auto y = firstRow; y < endRow; ++y)
+	{
+		auto luma = nv12 + static_cast<size_t>(y) * width;
+		auto uv = uvPlane + static_cast<size_t>(y / 2) * width;
+		auto pixel = bgra + static_cast<size_t>(y) * width * 4;
+		for (int x = 0; x < width; ++x, pixel += 4)
+		{
+			auto c = (luma[x] - 16) * 76309 + (1 << 15);
+			auto d = uv[x & ~1] - 128, e = uv[x | 1] - 128;
+			pixel[0] = clampByte(c + 132201 * d);
+			pixel[1] = clampByte(c - 25675 * d - 53279 * e);
+			pixel[2] = clampByte(c + 104597 * e);
+			pixel[3] = 0xFF;
+		}
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// Converts rows [firstRow, endRow) of an NV12 frame, both even, from a top-down BGRA source with the given stride in
+// bytes, which can be negative to flip it. The NV12 frame can be larger than the source, the source's last row and
+// column are repeated to fill it. BT.601 limited range, like the Media Foundation color converter.
+void ConvertBgraToNv12(const BYTE* bgra, ptrdiff_t stride, int width, int height,
+	BYTE* nv12, int nv12Width, int nv12Height, int firstRow, int endRow);
+
+// Tone maps rows [firstRow, endRow) of an RGBA half float frame to a packed top-down BGRA one. The source is scRGB,
+// linear with 1 for SDR white, and the stride in bytes can be negative to flip it. Channels above SDR white roll off
+// smoothly towards it instead of clipping, then everything is sRGB encoded. Uses F16C and AVX2 when the CPU has them.
+void ToneMapHalfToBgra(const BYTE* rgbaHalf, ptrdiff_t stride, int width, BYTE* bgra, int firstRow, int endRow);
+
+// Converts rows [firstRow, endRow) of an NV12 frame to a packed top-down BGRA one, the inverse of ConvertBgraToNv12.
+// The width and height are even.
+void ConvertNv12ToBgra(const BYTE* nv12, int width, int height, BYTE* bgra, int firstRow, int endRow);
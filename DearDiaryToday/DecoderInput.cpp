@@ -0,0 +1,26 @@
+#include "pch.h"
+#include "DecoderInput.h"
+
+using namespace std;
+
+StreamDecoderInput::StreamDecoderInput(unique_ptr<std::istream> istream, uint64_t size)
+	: istream(move(istream)), buffer(static_cast<size_t>(min<uint64_t>(size, DECODER_READ_BUFFER_SIZE))), remaining(size)
+{
+}
+
+span<const BYTE> StreamDecoderInput::Read()
+{
+	if (eof)
+		return {};
+
+	istream->read(reinterpret_cast<char*>(buffer.data()), static_cast<streamsize>(min<uint64_t>(buffer.size(), remaining)));
+	auto bytesRead = static_cast<size_t>(istream->gcount());
+	remaining -= bytesRead;
+	eof = !remaining || istream->eof() || !bytesRead;
+	return { buffer.data(), bytesRead };
+}
+
+MemoryDecoderInput::MemoryDecoderInput(span<const BYTE> data, shared_ptr<const void> owner)
+	: owner(move(owner)), data(data)
+{
+}
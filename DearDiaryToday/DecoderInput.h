@@ -0,0 +1,47 @@
+#pragma once
+
+// large enough that reading a stream takes a handful of calls instead of thousands
+constexpr size_t DECODER_READ_BUFFER_SIZE = 256 * 1024;
+// what skipped data is decoded into, it's thrown away so a few codec blocks' worth is plenty
+constexpr size_t DECODER_SKIP_BUFFER_SIZE = 64 * 1024;
+
+// where a decoder's compressed data comes from, handed out a chunk at a time
+class DecoderInput
+{
+public:
+	virtual ~DecoderInput() = default;
+
+	// the next chunk, valid until the next call. Empty once the input ended
+	virtual std::span<const BYTE> Read() = 0;
+
+	virtual bool IsEof() const = 0;
+};
+
+// buffered reads from a stream, at most size bytes of it if it's followed by other data
+class StreamDecoderInput final : public DecoderInput
+{
+	std::unique_ptr<std::istream> istream;
+	std::vector<BYTE> buffer;
+	uint64_t remaining;
+	bool eof{};
+
+public:
+	StreamDecoderInput(std::unique_ptr<std::istream>, uint64_t size = UINT64_MAX);
+
+	std::span<const BYTE> Read() override;
+	bool IsEof() const override { return eof; }
+};
+
+// data that's already in memory, such as a mapped file, handed out all at once without copying it
+class MemoryDecoderInput final : public DecoderInput
+{
+	const std::shared_ptr<const void> owner;
+	std::span<const BYTE> data;
+
+public:
+	// the owner keeps the data alive
+	MemoryDecoderInput(std::span<const BYTE>, std::shared_ptr<const void> owner = {});
+
+	std::span<const BYTE> Read() override { return std::exchange(data, {}); }
+	bool IsEof() const override { return data.empty(); }
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+// A diary file is a DiaryFileHeader followed by blocks, each a DiaryBlockHeader and independently compressed
+// xz streams. Every block starts with a key frame and keeps the same frame size throughout, so any block can be
+// decoded on its own. A cleanly closed file ends with the block index and a DiaryFileFooter.
+//
+// The block header is followed by the compressed size of each of its 1 + stripeCount streams as uint32_t, then
+// the streams themselves. The first stream holds the frame records: the time in ns since the previous frame of the
+// block (0 for the first one), the DiaryFrameType, and for deltas the changed tile bitmap. Each of the other
+// streams holds the pixel data of one stripe of tile rows, the whole stripe for key frames and the changed
+// tiles in it for deltas, so the stripes can be compressed and decompressed in parallel. All the streams of a block
+// are compressed with the block's DiaryCodec. Since version 4 the stream sizes are followed by the CRC32 of the
+// header, the stream sizes and the streams, so a block torn by a crash is found without decompressing it. In blocks
+// flagged DIARY_BLOCK_FRAME_INTERVALS, all of them since version 6, the frame records end with the interval in ns
+// the recorder was admitting frames at when the frame was captured, 0 without a limit. This logs the decisions of
+// the adaptive frame rate.
+//
+// A diary ring holds the same blocks in a single preallocated file of a fixed size, keeping only the most recent
+// ones. It starts with two copies of the DiaryRingHeader, each in its own page, and the copy with a valid checksum
+// and the highest sequence is current. The blocks are back to back from the tail, the oldest one, up to the head.
+// A block that doesn't fit before the end of the file goes at the start of the data instead, and wrapOffset marks
+// the end of the blocks before it. Rings have no index or footer, the header is updated after every block.
+
+constexpr uint32_t DIARY_FILE_MAGIC = 0x46444444;		// "DDDF"
+constexpr uint32_t DIARY_BLOCK_MAGIC = 0x42444444;		// "DDDB"
+constexpr uint32_t DIARY_FOOTER_MAGIC = 0x5A444444;		// "DDDZ"
+constexpr uint32_t DIARY_RING_MAGIC = 0x52444444;		// "DDDR"
+constexpr uint32_t DIARY_FORMAT_VERSION = 6;
+constexpr uint32_t DIARY_MIN_FORMAT_VERSION = 2;		// version 2 has no codec, its blocks are all LZMA
+constexpr uint32_t DIARY_MIN_CHECKSUM_VERSION = 4;		// blocks before it aren't checksummed
+constexpr uint32_t DIARY_MIN_BLOCK_FLAGS_VERSION = 5;	// blocks before it have no flags, and their RGB frames are all bottom-up and padded
+
+// DiaryBlockHeader flags
+constexpr uint16_t DIARY_BLOCK_BOTTOM_UP = 1;			// the RGB frames' rows are stored bottom-up
+constexpr uint16_t DIARY_BLOCK_FRAME_INTERVALS = 2;	// the frame records end with the frame interval
+
+enum class DiaryFrameType : uint32_t
+{
+	Key,		// full frame
+	Delta,		// changed tile bitmap, and the changed tiles XOR'd against the previous frame
+	Repeat,		// no tile changed, only the timestamp is recorded
+};
+
+enum class DiaryCodec : uint32_t
+{
+	Lzma,		// xz streams
+	Zstd,		// zstd frames
+	Lz4,		// lz4 frames
+};
+
+struct DiaryFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct DiaryBlockHeader
+{
+	uint32_t magic;
+	uint32_t compressedSize;		// of everything following the header, including the stream sizes and checksum
+	uint32_t frameCount;
+	int32_t width, height;
+	uint32_t format;
+	uint32_t stripeCount;
+	uint16_t codec;				// DiaryCodec
+	uint16_t flags;				// DIARY_BLOCK_*
+	int64_t firstFrameTimeNs, lastFrameTimeNs;
+};
+
+struct DiaryBlockIndexEntry
+{
+	uint64_t offset;			// of the block header from the start of the file
+	DiaryBlockHeader header;
+};
+
+struct DiaryFileFooter
+{
+	uint64_t indexOffset;
+	int64_t firstFrameTimeNs, lastFrameTimeNs;
+	uint32_t blockCount, frameCount;
+	int32_t maxWidth, maxHeight;
+	uint32_t reserved;
+	uint32_t magic;				// last, so it's the last thing in the file
+};
+
+struct DiaryRingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sequence;
+	uint64_t size;				// of the whole file
+	uint64_t tail, head;		// offset of the oldest block, and where the next one goes
+	uint64_t wrapOffset;		// end of the blocks before the wrap, 0 if they don't wrap
+	uint32_t blockCount;
+	uint32_t checksum;			// of everything before it
+};
+
+constexpr uint64_t DIARY_RING_HEADER_SLOT_SIZE = 4096;
+constexpr uint64_t DIARY_RING_DATA_OFFSET = 2 * DIARY_RING_HEADER_SLOT_SIZE;
+
+// FNV-1a, only meant to catch torn writes
+inline uint32_t GetDiaryChecksum(const void* data, size_t size)
+{
+	uint32_t hash = 0x811C9DC5U;
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ static_cast<const BYTE*>(data)[i]) * 0x01000193U;
+	return hash;
+}
+
+// CRC32 of a block, continuing from the checksum of what precedes the given data
+inline uint32_t GetDiaryBlockChecksum(const void* data, size_t size, uint32_t checksum = 0)
+{
+	return lzma_crc32(static_cast<const uint8_t*>(data), size, checksum);
+}
+
+inline uint32_t GetDiaryBlockChecksum(const DiaryBlockHeader& header, std::span<const std::span<const BYTE>> streams)
+{
+	auto checksum = GetDiaryBlockChecksum(&header, sizeof(DiaryBlockHeader));
+	for (auto& stream : streams)
+	{
+		auto streamSize = static_cast<uint32_t>(stream.size());
+		checksum = GetDiaryBlockChecksum(&streamSize, sizeof(uint32_t), checksum);
+	}
+	for (auto& stream : streams)
+		checksum = GetDiaryBlockChecksum(stream.data(), stream.size(), checksum);
+	return checksum;
+}
+
+// bytes per pixel of the formats frames are recorded in, 0 if the format isn't supported
+inline int GetDiaryFormatBytesPerPixel(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_R8G8B8A8_UNORM: return 4;
+	case DXGI_FORMAT_B8G8R8A8_UNORM: return 4;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT: return 8;
+	default: return 0;
+	}
+}
+
+// frames are stored as the rows of a single plane: the pixels for the RGB formats, top-down unless the block is
+// DIARY_BLOCK_BOTTOM_UP, and for NV12 the top-down luma rows followed by the interleaved chroma rows, one byte per
+// sample. RGB frames keep their size, NV12 frames are padded to an even one
+struct DiaryPlaneLayout
+{
+	int width, height;
+	int bytesPerPixel;
+};
+
+inline DiaryPlaneLayout GetDiaryPlaneLayout(DXGI_FORMAT format, int width, int height)
+{
+	if (format == DXGI_FORMAT_NV12)
+		return { width, height + height / 2, 1 };
+	return { width, height, GetDiaryFormatBytesPerPixel(format) };
+}
+
+inline void AccumulateDiaryBlock(DiaryFileFooter& summary, const DiaryBlockHeader& block)
+{
+	if (!summary.frameCount)
+		summary.firstFrameTimeNs = block.firstFrameTimeNs;
+	summary.lastFrameTimeNs = block.lastFrameTimeNs;
+	summary.frameCount += block.frameCount;
+	summary.maxWidth = (std::max)(summary.maxWidth, block.width);
+	summary.maxHeight = (std::max)(summary.maxHeight, block.height);
+}
+
+static_assert(sizeof(DiaryBlockHeader) == 48 && sizeof(DiaryBlockIndexEntry) == 56 && sizeof(DiaryFileFooter) == 48
+	&& sizeof(DiaryRingHeader) == 56,
+	"diary structures are written as-is and must not contain padding");
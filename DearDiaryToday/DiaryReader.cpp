@@ -0,0 +1,425 @@
+#include "pch.h"
+#include "DiaryReader.h"
+
+using namespace std;
+
+template<typename T>
+static bool Read(istream& stream, T& data)
+{
+	stream.read(reinterpret_cast<char*>(&data), sizeof(T));
+	return stream.gcount() == sizeof(T);
+}
+
+// a read-only stream over a diary in memory, which it keeps alive
+class MemoryStreamBuffer final : public streambuf
+{
+	shared_ptr<const void> owner;
+
+protected:
+	pos_type seekoff(off_type offset, ios_base::seekdir direction, ios_base::openmode) override
+	{
+		auto base = direction == ios_base::beg ? eback() : direction == ios_base::cur ? gptr() : egptr();
+		if (offset < eback() - base || offset > egptr() - base)
+			return pos_type(off_type(-1));
+
+		setg(eback(), base + offset, egptr());
+		return gptr() - eback();
+	}
+
+	pos_type seekpos(pos_type position, ios_base::openmode mode) override
+	{
+		return seekoff(off_type(position), ios_base::beg, mode);
+	}
+
+public:
+	MemoryStreamBuffer(span<const BYTE> memory, shared_ptr<const void> owner)
+		: owner(move(owner))
+	{
+		auto data = reinterpret_cast<char*>(const_cast<BYTE*>(memory.data()));
+		setg(data, data, data + memory.size());
+	}
+};
+
+class MemoryStream final : public istream
+{
+	MemoryStreamBuffer buffer;
+
+public:
+	MemoryStream(span<const BYTE> memory, shared_ptr<const void> owner)
+		: istream(nullptr), buffer(memory, std::move(owner)) // qualified, istream has a move of its own
+	{
+		rdbuf(&buffer);
+	}
+};
+
+DiaryReader::DiaryReader(filesystem::path path, DiaryInputMode inputMode)
+	: path(move(path))
+{
+	if (inputMode == DiaryInputMode::Mapped)
+	{
+		// falls back to reading the file if it can't be mapped
+		auto mappedFile = make_shared<const MappedFile>(this->path);
+		if (!mappedFile->GetData().empty())
+		{
+			memory = mappedFile->GetData();
+			memoryOwner = move(mappedFile);
+
+			MemoryStream stream(memory, memoryOwner);
+			Open(stream, memory.size());
+			return;
+		}
+	}
+
+	ifstream file(this->path, ios::binary | ios::in);
+
+	error_code ec;
+	auto fileSize = filesystem::file_size(this->path, ec);
+	if (!ec)
+		Open(file, fileSize);
+}
+
+DiaryReader::DiaryReader(shared_ptr<const vector<BYTE>> image)
+{
+	if (!image)
+		return;
+
+	memory = *image;
+	memoryOwner = move(image);
+
+	MemoryStream stream(memory, memoryOwner);
+	Open(stream, memory.size());
+}
+
+void DiaryReader::Open(istream& file, uint64_t fileSize)
+{
+	DiaryFileHeader fileHeader{};
+	if (!Read(file, fileHeader) || (fileHeader.magic != DIARY_FILE_MAGIC && fileHeader.magic != DIARY_RING_MAGIC)
+		|| fileHeader.version < DIARY_MIN_FORMAT_VERSION || fileHeader.version > DIARY_FORMAT_VERSION)
+		return; // not a diary, or nothing was written to it yet
+	version = fileHeader.version;
+
+	if (fileHeader.magic == DIARY_RING_MAGIC)
+		ReadRing(file, fileSize);
+	else if (!ReadIndex(file, fileSize))
+		ScanBlocks(file, fileSize); // the diary wasn't closed cleanly
+
+	if (version < DIARY_MIN_BLOCK_FLAGS_VERSION)
+		for (auto& block : blocks)
+			if (block.header.format != DXGI_FORMAT_NV12)
+				block.header.flags |= DIARY_BLOCK_BOTTOM_UP;
+}
+
+bool DiaryReader::ReadIndex(istream& file, uint64_t fileSize)
+{
+	if (fileSize < sizeof(DiaryFileHeader) + sizeof(DiaryFileFooter))
+		return false;
+
+	file.seekg(fileSize - sizeof(DiaryFileFooter));
+	if (!Read(file, summary) || summary.magic != DIARY_FOOTER_MAGIC
+		|| summary.indexOffset + summary.blockCount * sizeof(DiaryBlockIndexEntry) + sizeof(DiaryFileFooter) != fileSize)
+	{
+		summary = {};
+		return false;
+	}
+
+	blocks.resize(summary.blockCount);
+	file.seekg(summary.indexOffset);
+	file.read(reinterpret_cast<char*>(blocks.data()), blocks.size() * sizeof(DiaryBlockIndexEntry));
+	if (file.gcount() != static_cast<streamsize>(blocks.size() * sizeof(DiaryBlockIndexEntry)))
+	{
+		blocks.clear();
+		summary = {};
+		return false;
+	}
+
+	return true;
+}
+
+void DiaryReader::ScanBlocks(istream& file, uint64_t fileSize)
+{
+	file.clear();
+
+	// only the headers are read, the blocks themselves are skipped over
+	uint64_t offset = sizeof(DiaryFileHeader);
+	DiaryBlockHeader header{};
+	while (offset + sizeof(DiaryBlockHeader) <= fileSize)
+	{
+		file.seekg(offset);
+		if (!Read(file, header) || header.magic != DIARY_BLOCK_MAGIC)
+			break;
+
+		auto blockEnd = offset + sizeof(DiaryBlockHeader) + header.compressedSize;
+		if (blockEnd > fileSize || !IsBlockIntact(file, offset, header))
+			break; // partially written block
+
+		blocks.push_back({ offset, header });
+		offset = blockEnd;
+	}
+	truncated = offset != fileSize;
+
+	Summarize();
+}
+
+DiaryRingHeader DiaryReader::ReadRingHeader(istream& file, uint64_t fileSize)
+{
+	// the newest copy of the header that was completely written
+	DiaryRingHeader ring{};
+	for (uint64_t slot = 0; slot < 2; ++slot)
+	{
+		DiaryRingHeader copy{};
+		file.clear();
+		file.seekg(slot * DIARY_RING_HEADER_SLOT_SIZE);
+		if (Read(file, copy) && copy.magic == DIARY_RING_MAGIC && copy.size == fileSize
+			&& copy.checksum == GetDiaryChecksum(&copy, offsetof(DiaryRingHeader, checksum))
+			&& (!ring.magic || copy.sequence > ring.sequence))
+			ring = copy;
+	}
+	return ring;
+}
+
+DiaryRingHeader DiaryReader::ReadRingHeader(const filesystem::path& path)
+{
+	ifstream file(path, ios::binary | ios::in);
+
+	error_code ec;
+	auto fileSize = filesystem::file_size(path, ec);
+	return ec ? DiaryRingHeader{} : ReadRingHeader(file, fileSize);
+}
+
+void DiaryReader::ReadRing(istream& file, uint64_t fileSize)
+{
+	auto ring = ReadRingHeader(file, fileSize);
+	if (!ring.magic)
+		return;
+
+	// only the blocks the header lists count, what's past the head can be a complete block of an earlier session.
+	// The walk stops at the first one torn by the crash
+	auto offset = ring.tail;
+	DiaryBlockHeader header{};
+	for (uint32_t block = 0; block < ring.blockCount; ++block)
+	{
+		if (ring.wrapOffset && offset == ring.wrapOffset)
+			offset = DIARY_RING_DATA_OFFSET;
+
+		file.seekg(offset);
+		if (!Read(file, header) || header.magic != DIARY_BLOCK_MAGIC || offset + sizeof(DiaryBlockHeader) + header.compressedSize > ring.size
+			|| !IsBlockIntact(file, offset, header))
+			break;
+
+		blocks.push_back({ offset, header });
+		offset += sizeof(DiaryBlockHeader) + header.compressedSize;
+	}
+	truncated = blocks.size() != ring.blockCount;
+
+	Summarize();
+}
+
+bool DiaryReader::IsBlockIntact(istream& file, uint64_t offset, const DiaryBlockHeader& header) const
+{
+	if (version < DIARY_MIN_CHECKSUM_VERSION)
+		return true;
+
+	// only read back and checksummed, a block is decompressed only if it's exported
+	auto streamSizesSize = (1 + static_cast<size_t>(header.stripeCount)) * sizeof(uint32_t);
+	if (header.compressedSize < streamSizesSize + sizeof(uint32_t))
+		return false;
+
+	// the stream sizes and checksum are small, the streams are read a buffer at a time, or straight from memory
+	vector<BYTE> streamSizes(streamSizesSize + sizeof(uint32_t));
+	file.clear();
+	file.seekg(offset + sizeof(DiaryBlockHeader));
+	file.read(reinterpret_cast<char*>(streamSizes.data()), streamSizes.size());
+	if (file.gcount() != static_cast<streamsize>(streamSizes.size()))
+		return false;
+
+	uint32_t checksum;
+	memcpy(&checksum, streamSizes.data() + streamSizesSize, sizeof(uint32_t));
+	auto expected = GetDiaryBlockChecksum(&header, sizeof(DiaryBlockHeader));
+	expected = GetDiaryBlockChecksum(streamSizes.data(), streamSizesSize, expected);
+
+	auto streamsOffset = offset + sizeof(DiaryBlockHeader) + streamSizes.size();
+	auto streamsSize = header.compressedSize - streamSizes.size();
+	if (memoryOwner)
+	{
+		if (streamsOffset + streamsSize > memory.size())
+			return false;
+		expected = GetDiaryBlockChecksum(memory.data() + streamsOffset, streamsSize, expected);
+	}
+	else
+	{
+		vector<BYTE> buffer(min<size_t>(streamsSize, DECODER_READ_BUFFER_SIZE));
+		for (size_t remaining = streamsSize; remaining; )
+		{
+			auto chunk = min(remaining, buffer.size());
+			file.read(reinterpret_cast<char*>(buffer.data()), chunk);
+			if (file.gcount() != static_cast<streamsize>(chunk))
+				return false;
+			expected = GetDiaryBlockChecksum(buffer.data(), chunk, expected);
+			remaining -= chunk;
+		}
+	}
+	return checksum == expected;
+}
+
+bool DiaryReader::IsBlockIntact(size_t block) const
+{
+	auto& entry = blocks[block];
+	auto file = OpenStream(entry.offset);
+	return IsBlockIntact(*file, entry.offset, entry.header);
+}
+
+void DiaryReader::Summarize()
+{
+	summary = {};
+	for (auto& block : blocks)
+		AccumulateDiaryBlock(summary, block.header);
+	summary.blockCount = static_cast<uint32_t>(blocks.size());
+}
+
+size_t DiaryReader::FindBlock(int64_t timeNs) const
+{
+	// blocks are in time order, and a block's last frame is shown until the next block starts
+	auto nextBlock = upper_bound(blocks.begin(), blocks.end(), timeNs,
+		[](int64_t timeNs, const DiaryBlockIndexEntry& entry) { return timeNs < entry.header.firstFrameTimeNs; });
+	return nextBlock == blocks.begin() ? 0 : nextBlock - blocks.begin() - 1;
+}
+
+pair<size_t, size_t> DiaryReader::FindBlocks(int64_t startNs, int64_t endNs) const
+{
+	auto endBlock = upper_bound(blocks.begin(), blocks.end(), endNs,
+		[](int64_t timeNs, const DiaryBlockIndexEntry& entry) { return timeNs < entry.header.firstFrameTimeNs; }) - blocks.begin();
+	auto firstBlock = min(FindBlock(startNs), static_cast<size_t>(endBlock));
+	return { firstBlock, endBlock };
+}
+
+unique_ptr<istream> DiaryReader::OpenStream(uint64_t offset) const
+{
+	unique_ptr<istream> stream;
+	if (memoryOwner)
+		stream = make_unique<MemoryStream>(memory, memoryOwner);
+	else
+		stream = make_unique<ifstream>(path, ios::binary | ios::in);
+	stream->seekg(offset);
+	return stream;
+}
+
+unique_ptr<DecoderInput> DiaryReader::OpenInput(uint64_t offset, uint64_t size) const
+{
+	if (memoryOwner)
+	{
+		if (offset > memory.size())
+			return make_unique<MemoryDecoderInput>(span<const BYTE>{});
+		return make_unique<MemoryDecoderInput>(memory.subspan(static_cast<size_t>(offset), static_cast<size_t>(min<uint64_t>(size, memory.size() - offset))), memoryOwner);
+	}
+	return make_unique<StreamDecoderInput>(OpenStream(offset), size);
+}
+
+DiaryBlockReader::DiaryBlockReader(const DiaryReader& reader, size_t block, const ErrorFunc errorFunc, WorkerPool* workers)
+	: header(reader.GetBlocks()[block].header), workers(workers)
+{
+	auto layout = GetDiaryPlaneLayout(static_cast<DXGI_FORMAT>(header.format), header.width, header.height);
+	auto bytesPerPixel = layout.bytesPerPixel;
+	tiles = FrameTiles(layout.width, layout.height, bytesPerPixel);
+
+	frame.width = header.width;
+	frame.height = header.height;
+	frame.format = static_cast<DXGI_FORMAT>(header.format);
+	frame.bottomUp = header.flags & DIARY_BLOCK_BOTTOM_UP;
+	frame.timeNs = header.firstFrameTimeNs;
+
+	// the stream sizes follow the header, and the streams follow them back to back
+	auto offset = reader.GetBlocks()[block].offset + sizeof(DiaryBlockHeader);
+	vector<uint32_t> streamSizes(1 + header.stripeCount);
+	{
+		auto file = reader.OpenStream(offset);
+		file->read(reinterpret_cast<char*>(streamSizes.data()), streamSizes.size() * sizeof(uint32_t));
+		if (file->gcount() != static_cast<streamsize>(streamSizes.size() * sizeof(uint32_t)) || !bytesPerPixel
+			|| header.stripeCount == 0 || header.stripeCount > tiles.GetMaxStripeCount())
+			return; // no frames can be read
+	}
+	offset += streamSizes.size() * sizeof(uint32_t);
+	if (reader.GetVersion() >= DIARY_MIN_CHECKSUM_VERSION)
+		offset += sizeof(uint32_t); // checked when the diary was opened
+
+	for (auto streamSize : streamSizes)
+	{
+		auto decoder = StreamDecoder::Create(static_cast<DiaryCodec>(header.codec), reader.OpenInput(offset, streamSize), errorFunc);
+		if (!decoder)
+			return; // codec not supported by this build
+		if (!recordDecoder)
+			recordDecoder = move(decoder);
+		else
+			stripeDecoders.push_back(move(decoder));
+		offset += streamSize;
+	}
+
+	frame.data.resize(static_cast<size_t>(layout.width) * layout.height * bytesPerPixel);
+	stripeData.resize(header.stripeCount);
+}
+
+bool DiaryBlockReader::DecodeStripes(const function<bool(size_t)>& decodeStripe)
+{
+	atomic<bool> success = true;
+	auto run = [&](size_t stripe) {
+		if (!decodeStripe(stripe))
+			success = false;
+		};
+
+	if (workers)
+		workers->Run(stripeDecoders.size(), run);
+	else
+		for (size_t stripe = 0; stripe < stripeDecoders.size(); ++stripe)
+			run(stripe);
+
+	return success;
+}
+
+bool DiaryBlockReader::ReadFrame()
+{
+	if (framesRead == header.frameCount || frame.data.empty())
+		return false;
+
+	int64_t timeSpanNs{};
+	if (!recordDecoder->Decode(timeSpanNs) || !recordDecoder->Decode(frame.type))
+		return false;
+
+	auto rowSize = frame.data.size() / tiles.GetHeight();
+	if (frame.type == DiaryFrameType::Key)
+	{
+		auto decoded = DecodeStripes([&](size_t stripe) {
+			auto stripeBounds = tiles.GetStripeBounds(stripe, stripeDecoders.size());
+			span stripeRows{ frame.data.data() + stripeBounds.y * rowSize, stripeBounds.height * rowSize };
+			return stripeDecoders[stripe]->Decode(stripeRows) == stripeRows.size();
+			});
+		if (!decoded)
+			return false; // truncated frame
+	}
+	else if (!framesRead)
+		return false; // delta without its key frame
+	else if (frame.type == DiaryFrameType::Delta)
+	{
+		changedTiles.resize(tiles.GetBitmapSize());
+		if (recordDecoder->Decode(span{ changedTiles }) != changedTiles.size())
+			return false; // truncated frame
+
+		auto decoded = DecodeStripes([&](size_t stripe) {
+			auto stripeBounds = tiles.GetStripeBounds(stripe, stripeDecoders.size());
+			auto& tileData = stripeData[stripe];
+			tileData.resize(tiles.GetChangedTilesDataSize(changedTiles, stripeBounds.firstTile, stripeBounds.endTile));
+			if (stripeDecoders[stripe]->Decode(span{ tileData }) != tileData.size())
+				return false;
+
+			tiles.ApplyChangedTiles(frame.data, changedTiles, tileData, stripeBounds.firstTile, stripeBounds.endTile);
+			return true;
+			});
+		if (!decoded)
+			return false; // truncated frame
+	}
+
+	if ((header.flags & DIARY_BLOCK_FRAME_INTERVALS) && !recordDecoder->Decode(frame.frameIntervalNs))
+		return false;
+
+	frame.timeNs += timeSpanNs;
+	++framesRead;
+	return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "DiaryFormat.h"
+#include "FrameTiles.h"
+#include "MappedFile.h"
+#include "StreamDecoder.h"
+#include "WorkerPool.h"
+
+enum class DiaryInputMode
+{
+	Buffered,	// large reads through a file stream
+	Mapped,		// the file is mapped, and the decoders read straight from the mapping
+};
+
+class DiaryReader final
+{
+	std::filesystem::path path;
+	std::shared_ptr<const void> memoryOwner;		// the mapped file or the image, if the diary is in memory
+	std::span<const BYTE> memory;
+	std::vector<DiaryBlockIndexEntry> blocks;
+	DiaryFileFooter summary{};
+	uint32_t version{};
+	bool truncated{};
+
+	void Open(std::istream&, uint64_t fileSize);
+	bool IsBlockIntact(std::istream&, uint64_t offset, const DiaryBlockHeader&) const;
+	bool ReadIndex(std::istream&, uint64_t fileSize);
+	void ScanBlocks(std::istream&, uint64_t fileSize);
+	void ReadRing(std::istream&, uint64_t fileSize);
+	static DiaryRingHeader ReadRingHeader(std::istream&, uint64_t fileSize);
+	void Summarize();
+
+public:
+	// reads diary files as well as diary rings
+	DiaryReader(std::filesystem::path, DiaryInputMode = DiaryInputMode::Mapped);
+	// reads a diary held in memory, such as a DiaryRing snapshot
+	DiaryReader(std::shared_ptr<const std::vector<BYTE>> image);
+
+	// only the current header of a ring, without reading any of its blocks. Zeroed if the file isn't a ring or
+	// neither copy of the header is intact
+	static DiaryRingHeader ReadRingHeader(const std::filesystem::path&);
+
+	// empty for diaries held in memory
+	const std::filesystem::path& GetPath() const { return path; }
+	// a new stream over the diary, positioned at the given offset
+	std::unique_ptr<std::istream> OpenStream(uint64_t offset) const;
+	// the input for a decoder reading the size bytes at the given offset
+	std::unique_ptr<DecoderInput> OpenInput(uint64_t offset, uint64_t size) const;
+	const DiaryFileFooter& GetSummary() const { return summary; }
+	uint32_t GetVersion() const { return version; }
+	// the diary ends in blocks torn by a crash, which were left out
+	bool IsTruncated() const { return truncated; }
+	const std::vector<DiaryBlockIndexEntry>& GetBlocks() const { return blocks; }
+
+	// checksums the block again, the index of a cleanly closed diary is trusted when it's opened
+	bool IsBlockIntact(size_t block) const;
+
+	// the block holding the frame shown at the given time, clamped to the recorded blocks
+	size_t FindBlock(int64_t timeNs) const;
+	// the blocks holding the frames shown between the given times, as [first, end)
+	std::pair<size_t, size_t> FindBlocks(int64_t startNs, int64_t endNs) const;
+};
+
+struct DiaryFrame
+{
+	int width{}, height{};
+	DXGI_FORMAT format{};
+	bool bottomUp{};
+	int64_t timeNs{};
+	DiaryFrameType type{};
+	int64_t frameIntervalNs{};	// the interval frames were being recorded at, 0 without a limit or if the diary didn't log it
+	std::vector<BYTE> data;		// laid out as per GetDiaryPlaneLayout
+};
+
+// decodes the frames of a single block in order, reconstructing them from the key frame and deltas
+class DiaryBlockReader final
+{
+	const DiaryBlockHeader header;
+	WorkerPool* const workers;
+	std::unique_ptr<StreamDecoder> recordDecoder;
+	std::vector<std::unique_ptr<StreamDecoder>> stripeDecoders;
+	FrameTiles tiles;
+	DiaryFrame frame;
+	std::vector<BYTE> changedTiles;
+	std::vector<std::vector<BYTE>> stripeData;
+	uint32_t framesRead{};
+
+	bool DecodeStripes(const std::function<bool(size_t)>&);
+
+public:
+	// the stripes are decoded in parallel if a worker pool is given
+	DiaryBlockReader(const DiaryReader&, size_t block, const ErrorFunc, WorkerPool* workers = nullptr);
+
+	bool ReadFrame();
+	const DiaryFrame& GetFrame() const { return frame; }
+};
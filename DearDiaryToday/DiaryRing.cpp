@@ -0,0 +1,322 @@
+#include "pch.h"
+#include "DiaryRing.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+DiaryRing::DiaryRing(const filesystem::path& path, uint64_t size, chrono::nanoseconds maxDuration, const ErrorFunc errorFunc)
+	: errorFunc(errorFunc), maxDurationNs(maxDuration.count())
+{
+	// whole pages, with room for at least a few blocks
+	size = max((size + DIARY_RING_HEADER_SLOT_SIZE - 1) / DIARY_RING_HEADER_SLOT_SIZE * DIARY_RING_HEADER_SLOT_SIZE, 4 * DIARY_RING_DATA_OFFSET);
+
+#ifdef _WIN32
+	// the file is only ever sized here, growing it later would defeat the point
+	file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		errorFunc(HRESULT_FROM_WIN32(GetLastError()));
+		return;
+	}
+
+	LARGE_INTEGER fileSize{};
+	fileSize.QuadPart = static_cast<LONGLONG>(size);
+	if (!SetFilePointerEx(file, fileSize, nullptr, FILE_BEGIN) || !SetEndOfFile(file)
+		|| !(mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, 0, 0, nullptr))
+		|| !(view = static_cast<BYTE*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0))))
+	{
+		errorFunc(HRESULT_FROM_WIN32(GetLastError()));
+		return;
+	}
+#else
+	file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (file < 0 || ftruncate(file, static_cast<off_t>(size)) != 0)
+	{
+		errorFunc(E_FAIL);
+		return;
+	}
+
+	auto mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	if (mapped == MAP_FAILED)
+	{
+		errorFunc(E_FAIL);
+		return;
+	}
+	view = static_cast<BYTE*>(mapped);
+#endif
+
+	// both copies of the header are cleared, an old one could otherwise have a higher sequence
+	memset(view, 0, DIARY_RING_DATA_OFFSET);
+	header.magic = DIARY_RING_MAGIC;
+	header.version = DIARY_FORMAT_VERSION;
+	header.size = size;
+	header.tail = header.head = DIARY_RING_DATA_OFFSET;
+
+	// into both slots, readers tell a ring from the start of the file
+	PublishHeader();
+	PublishHeader();
+
+	thread = std::thread([this] { WriteQueuedBlocks(); });
+}
+
+DiaryRing::~DiaryRing()
+{
+	if (thread.joinable())
+	{
+		{
+			lock_guard lock(mutex);
+			stopping = true;
+		}
+		queueChanged.notify_all();
+		thread.join();
+	}
+
+#ifdef _WIN32
+	if (view)
+		UnmapViewOfFile(view);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+#else
+	if (view)
+		munmap(view, header.size);
+	if (file >= 0)
+		close(file);
+#endif
+}
+
+bool DiaryRing::WriteBlock(const DiaryBlockHeader& blockHeader, span<const span<const BYTE>> streams)
+{
+	uint64_t size = sizeof(DiaryBlockHeader) + blockHeader.compressedSize;
+	if (!view)
+		return false;
+	if (size > GetDataSize())
+	{
+		// the writer ends blocks long before they get this large, only a single huge frame or a sudden drop in how
+		// well the frames compress gets here, and that tends to last
+		if (!droppingBlocks)
+			errorFunc(HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE));
+		droppingBlocks = true;
+		return false;
+	}
+	droppingBlocks = false;
+
+	// serialized here, the writer thread only has to copy it into place
+	vector<BYTE> block(size);
+	auto data = block.data();
+	memcpy(data, &blockHeader, sizeof(DiaryBlockHeader));
+	data += sizeof(DiaryBlockHeader);
+	for (auto& stream : streams)
+	{
+		auto streamSize = static_cast<uint32_t>(stream.size());
+		memcpy(data, &streamSize, sizeof(uint32_t));
+		data += sizeof(uint32_t);
+	}
+	auto checksum = GetDiaryBlockChecksum(blockHeader, streams);
+	memcpy(data, &checksum, sizeof(uint32_t));
+	data += sizeof(uint32_t);
+	for (auto& stream : streams)
+	{
+		memcpy(data, stream.data(), stream.size());
+		data += stream.size();
+	}
+
+	// a block larger than the budget still goes through, once it's the only one queued
+	unique_lock lock(mutex);
+	queueChanged.wait(lock, [&] { return !queuedBytes || queuedBytes + size <= DIARY_RING_WRITE_BUDGET; });
+	queuedBytes += size;
+	queuedBlocks.push_back(move(block));
+	++writtenBlockCount;
+	queueChanged.notify_all();
+	return true;
+}
+
+void DiaryRing::WriteQueuedBlocks()
+{
+	unique_lock lock(mutex);
+	for (;;)
+	{
+		queueChanged.wait(lock, [&] { return stopping || !queuedBlocks.empty(); });
+		if (queuedBlocks.empty())
+			return;
+
+		// only ever pushed to the back meanwhile, which leaves the front where it is
+		auto& block = queuedBlocks.front();
+		lock.unlock();
+		StoreBlock(block);
+		lock.lock();
+
+		queuedBytes -= block.size();
+		queuedBlocks.pop_front();
+		++storedBlockCount;
+		queueChanged.notify_all();
+	}
+}
+
+void DiaryRing::StoreBlock(span<const BYTE> block)
+{
+	DiaryBlockHeader blockHeader;
+	memcpy(&blockHeader, block.data(), sizeof(DiaryBlockHeader));
+	uint64_t size = block.size();
+
+	// the block goes at the head, or at the start of the data if it doesn't fit before the end
+	uint64_t offset;
+	bool wrap, evicted;
+	{
+		// the snapshots copying blocks out of the ring are done before any is overwritten
+		unique_lock lock(mutex);
+		queueChanged.wait(lock, [&] { return !copyingSnapshots; });
+		auto blockCount = blocks.size();
+		offset = header.head;
+		wrap = offset + size > header.size;
+		if (wrap)
+		{
+			// anything past the head is older than what's before it
+			while (!blocks.empty() && blocks.front().offset >= header.head)
+				EvictOldestBlock();
+			offset = DIARY_RING_DATA_OFFSET;
+		}
+		while (!blocks.empty() && blocks.front().offset >= offset && blocks.front().offset < offset + size)
+			EvictOldestBlock();
+		evicted = blocks.size() != blockCount;
+	}
+
+	// the evicted blocks must be gone from the header on disk before they're overwritten. Snapshots only read the blocks
+	// still listed, so the copy itself doesn't need the lock
+	if (evicted)
+		PublishHeader();
+	memcpy(view + offset, block.data(), size);
+
+	// the block is on disk before the header that points to it is even in the mapping, which bounds what a power
+	// loss can take to the blocks still queued. A crash of the process alone loses nothing, the mapping outlives it
+	Flush(offset, size);
+
+	{
+		lock_guard lock(mutex);
+		if (wrap && !blocks.empty())
+			header.wrapOffset = header.head;
+		blocks.push_back({ offset, blockHeader });
+		header.head = offset + size;
+
+		// the block the window starts in stays, so the whole window is always there
+		if (maxDurationNs)
+		{
+			auto windowStartNs = blockHeader.lastFrameTimeNs - maxDurationNs;
+			while (blocks.size() > 1 && blocks[1].header.firstFrameTimeNs <= windowStartNs)
+				EvictOldestBlock();
+		}
+
+		header.tail = blocks.front().offset;
+		header.blockCount = static_cast<uint32_t>(blocks.size());
+	}
+	PublishHeader();
+}
+
+void DiaryRing::EvictOldestBlock()
+{
+	blocks.pop_front();
+	header.tail = blocks.empty() ? header.head : blocks.front().offset;
+	header.blockCount = static_cast<uint32_t>(blocks.size());
+
+	// back in order once the blocks before the wrap are all gone
+	if (blocks.empty() || blocks.front().offset <= blocks.back().offset)
+		header.wrapOffset = 0;
+}
+
+void DiaryRing::PublishHeader()
+{
+	// alternating between the copies, so a torn write leaves the previous header intact
+	++header.sequence;
+	header.checksum = GetDiaryChecksum(&header, offsetof(DiaryRingHeader, checksum));
+	memcpy(view + header.sequence % 2 * DIARY_RING_HEADER_SLOT_SIZE, &header, sizeof(DiaryRingHeader));
+	Flush(header.sequence % 2 * DIARY_RING_HEADER_SLOT_SIZE, sizeof(DiaryRingHeader));
+}
+
+void DiaryRing::Flush(uint64_t offset, uint64_t size)
+{
+	// waits for the pages to reach the disk, past its own cache. Only queueing the write-back would leave the OS free
+	// to write the header before the block it points to
+#ifdef _WIN32
+	FlushViewOfFile(view + offset, size);
+	FlushFileBuffers(file);
+#else
+	auto pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+	auto pageOffset = offset / pageSize * pageSize;
+	msync(view + pageOffset, offset + size - pageOffset, MS_SYNC);
+#endif
+}
+
+vector<BYTE> DiaryRing::Snapshot(int64_t startNs, int64_t endNs) const
+{
+	if (!view)
+		return {};
+
+	// everything written so far. Only the index entries are taken under the lock, the writer thread doesn't overwrite
+	// any block while they're copied, and the blocks written meanwhile only queue up
+	vector<DiaryBlockIndexEntry> entries;
+	{
+		unique_lock lock(mutex);
+		auto writtenBlocks = writtenBlockCount;
+		queueChanged.wait(lock, [&] { return storedBlockCount >= writtenBlocks; });
+
+		// a block's last frame is shown until the next block starts, same as DiaryReader::FindBlocks
+		size_t firstBlock = 0, endBlock = 0;
+		for (; endBlock < blocks.size() && blocks[endBlock].header.firstFrameTimeNs <= endNs; ++endBlock)
+			if (blocks[endBlock].header.firstFrameTimeNs <= startNs)
+				firstBlock = endBlock;
+		entries.assign(blocks.begin() + firstBlock, blocks.begin() + endBlock);
+		++copyingSnapshots;
+	}
+
+	uint64_t size = sizeof(DiaryFileHeader) + entries.size() * sizeof(DiaryBlockIndexEntry) + sizeof(DiaryFileFooter);
+	for (auto& entry : entries)
+		size += sizeof(DiaryBlockHeader) + entry.header.compressedSize;
+
+	vector<BYTE> snapshot(size);
+	auto data = snapshot.data();
+	DiaryFileHeader fileHeader{ DIARY_FILE_MAGIC, DIARY_FORMAT_VERSION };
+	memcpy(data, &fileHeader, sizeof(DiaryFileHeader));
+	data += sizeof(DiaryFileHeader);
+
+	// the blocks are laid out back to back in time order, the index follows them
+	vector<DiaryBlockIndexEntry> index;
+	index.reserve(entries.size());
+	DiaryFileFooter footer{};
+	for (auto& entry : entries)
+	{
+		auto blockSize = sizeof(DiaryBlockHeader) + entry.header.compressedSize;
+		index.push_back({ static_cast<uint64_t>(data - snapshot.data()), entry.header });
+		memcpy(data, view + entry.offset, blockSize);
+		data += blockSize;
+		AccumulateDiaryBlock(footer, entry.header);
+	}
+	{
+		lock_guard lock(mutex);
+		--copyingSnapshots;
+	}
+	queueChanged.notify_all();
+
+	footer.indexOffset = data - snapshot.data();
+	memcpy(data, index.data(), index.size() * sizeof(DiaryBlockIndexEntry));
+	data += index.size() * sizeof(DiaryBlockIndexEntry);
+
+	footer.blockCount = static_cast<uint32_t>(index.size());
+	footer.magic = DIARY_FOOTER_MAGIC;
+	memcpy(data, &footer, sizeof(DiaryFileFooter));
+
+	return snapshot;
+}
+
+deque<DiaryBlockIndexEntry> DiaryRing::GetBlocks() const
+{
+	unique_lock lock(mutex);
+	auto writtenBlocks = writtenBlockCount;
+	queueChanged.wait(lock, [&] { return storedBlockCount >= writtenBlocks; });
+	return blocks;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "DiaryFormat.h"
+
+// blocks waiting for the ring's writer thread, past this the caller waits for it to catch up
+constexpr size_t DIARY_RING_WRITE_BUDGET = 64 * 1024 * 1024;
+
+// a preallocated, memory-mapped diary ring file, see DiaryFormat.h. Writing a block evicts as many of the oldest
+// blocks as needed to make room for it, so the file never changes size, as well as the blocks that are entirely
+// older than the time window. Blocks are copied into the mapping and flushed to disk by a thread of its own, so
+// recording doesn't wait on the disk
+class DiaryRing final
+{
+	const ErrorFunc errorFunc;
+	const int64_t maxDurationNs;
+	BYTE* view{};
+	DiaryRingHeader header{};		// the writer thread's, once it's started
+	std::deque<DiaryBlockIndexEntry> blocks;
+	bool droppingBlocks{};
+
+#ifdef _WIN32
+	HANDLE file{ INVALID_HANDLE_VALUE }, mapping{};
+#else
+	int file{ -1 };
+#endif
+
+	// the blocks serialized as they're stored, in the order they were written. A block stays queued until it's in
+	// the ring, the mutex also guards the block list against the snapshots
+	mutable std::mutex mutex;
+	mutable std::condition_variable queueChanged;
+	std::deque<std::vector<BYTE>> queuedBlocks;
+	size_t queuedBytes{};
+	uint64_t writtenBlockCount{}, storedBlockCount{};		// ever handed to WriteBlock, and ever stored
+	mutable size_t copyingSnapshots{};		// the blocks they copy can't be overwritten meanwhile
+	bool stopping{};
+	std::thread thread;
+
+	// the writer thread's side
+	void WriteQueuedBlocks();
+	void StoreBlock(std::span<const BYTE>);
+	void EvictOldestBlock();
+	void PublishHeader();
+	void Flush(uint64_t offset, uint64_t size);
+
+public:
+	// the file is created or resized as needed, whatever it held before is discarded. A duration of 0 keeps
+	// as much as fits
+	DiaryRing(const std::filesystem::path&, uint64_t size, std::chrono::nanoseconds maxDuration, const ErrorFunc);
+	// waits for the queued blocks to be written
+	~DiaryRing();
+
+	DiaryRing(const DiaryRing&) = delete;
+	DiaryRing& operator=(const DiaryRing&) = delete;
+
+	// queues the block for the writer thread, only waiting once DIARY_RING_WRITE_BUDGET is used up. False if the
+	// block is larger than the whole ring, or the ring couldn't be mapped, and it was dropped. Blocks too large for
+	// the ring are reported through the error callback, once for a run of them
+	bool WriteBlock(const DiaryBlockHeader&, std::span<const std::span<const BYTE>> streams);
+
+	// a copy of the blocks currently in the ring as a complete diary file, which stays valid while recording goes on.
+	// Only the blocks holding the frames shown between the given times are copied. Waits for the blocks queued before
+	// the call to be stored first. Blocks can still be queued while it copies, the writer thread stores them after
+	std::vector<BYTE> Snapshot(int64_t startNs = INT64_MIN, int64_t endNs = INT64_MAX) const;
+
+	// the blocks in the ring once the ones queued before the call are stored
+	std::deque<DiaryBlockIndexEntry> GetBlocks() const;
+	uint64_t GetSize() const { return header.size; }
+	uint64_t GetDataSize() const { return header.size - DIARY_RING_DATA_OFFSET; }
+};
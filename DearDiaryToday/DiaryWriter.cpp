@@ -0,0 +1,155 @@
+#include "pch.h"
+#include "DiaryWriter.h"
+
+using namespace std;
+
+DiaryWriter::DiaryWriter(const filesystem::path& path, WorkerPool& workers, const ErrorFunc errorFunc, StreamCodec codec, PipelineStatistics* statistics,
+	size_t writeBufferBudget)
+	: output(make_unique<AsyncFileWriter>(path, errorFunc, writeBufferBudget)), errorFunc(errorFunc), workers(workers), statistics(statistics), codec(codec),
+	recordEncoder(StreamEncoder::Create(codec, errorFunc))
+{
+	Write(DiaryFileHeader{ DIARY_FILE_MAGIC, DIARY_FORMAT_VERSION });
+}
+
+DiaryWriter::DiaryWriter(std::unique_ptr<std::ostream> ostream, WorkerPool& workers, const ErrorFunc errorFunc, StreamCodec codec, PipelineStatistics* statistics)
+	: output(make_unique<AsyncFileWriter>(move(ostream), errorFunc)), errorFunc(errorFunc), workers(workers), statistics(statistics), codec(codec),
+	recordEncoder(StreamEncoder::Create(codec, errorFunc))
+{
+	Write(DiaryFileHeader{ DIARY_FILE_MAGIC, DIARY_FORMAT_VERSION });
+}
+
+DiaryWriter::DiaryWriter(DiaryRing& ring, WorkerPool& workers, const ErrorFunc errorFunc, StreamCodec codec, PipelineStatistics* statistics)
+	: ring(&ring), errorFunc(errorFunc), workers(workers), statistics(statistics), codec(codec),
+	recordEncoder(StreamEncoder::Create(codec, errorFunc))
+{
+}
+
+DiaryWriter::~DiaryWriter()
+{
+	EndBlock();
+
+	// rings are always complete
+	if (ring)
+		return;
+
+	// the index lets readers find the blocks without walking the whole file
+	footer.indexOffset = offset;
+	for (auto& entry : blockIndex)
+		Write(entry);
+
+	footer.blockCount = static_cast<uint32_t>(blockIndex.size());
+	footer.magic = DIARY_FOOTER_MAGIC;
+	Write(footer);
+}
+
+void DiaryWriter::BeginFrame(int width, int height, DXGI_FORMAT format, bool keyFrame, size_t stripeCount)
+{
+	if (keyFrame)
+	{
+		EndBlock();
+
+		block.magic = DIARY_BLOCK_MAGIC;
+		block.width = width;
+		block.height = height;
+		block.format = format;
+		block.stripeCount = static_cast<uint32_t>(stripeCount);
+		block.codec = static_cast<uint16_t>(codec.codec);
+		block.flags = DIARY_BLOCK_FRAME_INTERVALS;
+
+		while (stripeEncoders.size() < stripeCount)
+			stripeEncoders.push_back(StreamEncoder::Create(codec, errorFunc));
+	}
+
+	// a block must start with a key frame
+	assert(block.magic == DIARY_BLOCK_MAGIC && width == block.width && height == block.height);
+}
+
+void DiaryWriter::EndFrame(int64_t timeNs, DiaryFrameType type, span<const BYTE> changedTiles)
+{
+	if (!block.frameCount)
+		block.firstFrameTimeNs = block.lastFrameTimeNs = timeNs;
+
+	recordEncoder->Encode(timeNs - block.lastFrameTimeNs);
+	recordEncoder->Encode(type);
+	if (!changedTiles.empty())
+		recordEncoder->Encode(changedTiles);
+	recordEncoder->Encode(frameIntervalNs);
+
+	block.lastFrameTimeNs = timeNs;
+	++block.frameCount;
+}
+
+uint64_t DiaryWriter::GetBlockBytesIn() const
+{
+	auto bytesIn = recordEncoder->GetStreamBytesIn();
+	for (size_t stripe = 0; stripe < block.stripeCount; ++stripe)
+		bytesIn += stripeEncoders[stripe]->GetStreamBytesIn();
+	return bytesIn;
+}
+
+bool DiaryWriter::IsBlockNearRingCapacity() const
+{
+	// the compressed size is only known once the block is finished, the last block's ratio is the best guess
+	return ring && block.frameCount && GetBlockBytesIn() * compressionRatio >= ring->GetDataSize() * DIARY_RING_MAX_BLOCK_SHARE;
+}
+
+void DiaryWriter::Flush()
+{
+	EndBlock();
+	if (output)
+		output->Flush();
+}
+
+void DiaryWriter::EndBlock()
+{
+	if (!block.frameCount)
+		return;
+
+	auto bytesIn = GetBlockBytesIn();
+
+	// finishing a stream flushes what the encoder still buffers, which is most of the work for small blocks
+	vector<span<const BYTE>> streams(1 + block.stripeCount);
+	workers.Run(streams.size(), [&](size_t stream) {
+		streams[stream] = stream ? stripeEncoders[stream - 1]->Finish() : recordEncoder->Finish();
+		});
+
+	block.compressedSize = static_cast<uint32_t>(streams.size() * sizeof(uint32_t) + sizeof(uint32_t));
+	for (auto& stream : streams)
+		block.compressedSize += static_cast<uint32_t>(stream.size());
+
+	if (bytesIn)
+		compressionRatio = static_cast<double>(block.compressedSize) / bytesIn;
+
+	auto writeStart = hr_clock::now();
+	if (ring)
+	{
+		// the ring reports it, the frames are counted as lost
+		if (!ring->WriteBlock(block, streams) && statistics)
+			PipelineStatistics::Add(statistics->framesDroppedBlockTooLarge, block.frameCount);
+	}
+	else
+	{
+		blockIndex.push_back({ offset, block });
+		Write(block);
+		for (auto& stream : streams)
+			Write(static_cast<uint32_t>(stream.size()));
+		Write(GetDiaryBlockChecksum(block, streams));
+		for (auto& stream : streams)
+			Write(stream);
+
+		// each block is on disk before the next one is written, a crash loses at most the blocks still queued, and
+		// the scan on reopening stops at the first torn one
+		output->Sync();
+	}
+
+	if (statistics)
+	{
+		statistics->writeLatency.Record(hr_clock::now() - writeStart);
+		PipelineStatistics::Add(statistics->encoderBytesIn, bytesIn);
+		PipelineStatistics::Add(statistics->encoderBytesOut, block.compressedSize);
+	}
+
+	AccumulateDiaryBlock(footer, block);
+
+	block = {};
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "DiaryFormat.h"
+#include "AsyncFileWriter.h"
+#include "DiaryRing.h"
+#include "StreamEncoder.h"
+#include "WorkerPool.h"
+#include "PipelineStatistics.h"
+
+// blocks written to a ring end once their compressed size is estimated to reach this share of it, so none outgrows
+// the ring and gets dropped
+constexpr double DIARY_RING_MAX_BLOCK_SHARE = 0.25;
+
+class DiaryWriter final
+{
+	std::unique_ptr<AsyncFileWriter> output;
+	DiaryRing* const ring{};
+	const ErrorFunc errorFunc;
+	WorkerPool& workers;
+	PipelineStatistics* const statistics;
+	const StreamCodec codec;
+	std::unique_ptr<StreamEncoder> recordEncoder;
+	std::vector<std::unique_ptr<StreamEncoder>> stripeEncoders;
+
+	uint64_t offset{};
+	int64_t frameIntervalNs{};
+	double compressionRatio = 1;		// compressed over uncompressed bytes of the last block
+	DiaryBlockHeader block{};
+	std::vector<DiaryBlockIndexEntry> blockIndex;
+	DiaryFileFooter footer{};
+
+	template<typename T>
+	void Write(const T& data)
+	{
+		Write({ reinterpret_cast<const BYTE*>(&data), sizeof(T) });
+	}
+
+	void Write(std::span<const BYTE> data)
+	{
+		output->Write(data);
+		offset += data.size();
+	}
+
+	void EndBlock();
+
+public:
+	// the codec must be supported by this build. The file is written from a thread of its own, so recording only
+	// waits on the disk once the write buffer budget is used up. That thread also flushes every block to the disk
+	DiaryWriter(const std::filesystem::path&, WorkerPool&, const ErrorFunc, StreamCodec = {}, PipelineStatistics* = nullptr,
+		size_t writeBufferBudget = ASYNC_WRITE_DEFAULT_BUDGET);
+	DiaryWriter(std::unique_ptr<std::ostream>, WorkerPool&, const ErrorFunc, StreamCodec = {}, PipelineStatistics* = nullptr);
+	// writes the blocks to a ring instead of a file, which only keeps the most recent ones
+	DiaryWriter(DiaryRing&, WorkerPool&, const ErrorFunc, StreamCodec = {}, PipelineStatistics* = nullptr);
+	~DiaryWriter();
+
+	bool HasBlock() const { return block.frameCount > 0; }
+	size_t GetStripeCount() const { return block.stripeCount; }
+
+	// uncompressed bytes written to the current block so far
+	uint64_t GetBlockBytesIn() const;
+
+	// true once the current block should end to stay well within the ring, always false when writing a file
+	bool IsBlockNearRingCapacity() const;
+
+	// key frames start a new block split into the given number of stripes, the other frame types continue the current one
+	void BeginFrame(int width, int height, DXGI_FORMAT format, bool keyFrame, size_t stripeCount);
+
+	// each stripe encoder can be used from a different thread between BeginFrame and EndFrame
+	StreamEncoder& GetStripeEncoder(size_t stripe) { return *stripeEncoders[stripe]; }
+
+	// the interval frames are being admitted at, recorded with every frame from then on
+	void SetFrameInterval(int64_t intervalNs) { frameIntervalNs = intervalNs; }
+
+	// writes the frame record once all of its stripes were encoded
+	void EndFrame(int64_t timeNs, DiaryFrameType type, std::span<const BYTE> changedTiles);
+
+	// ends the current block early so everything recorded so far can be read back, the next frame must be a key frame.
+	// Waits for the file to be written
+	void Flush();
+};
@@ -0,0 +1,82 @@
+#include "pch.h"
+#include "FrameBufferPool.h"
+
+using namespace std;
+
+bool MemoryBudget::TryAcquire(size_t bytes)
+{
+	auto used = usedBytes.load();
+	do
+	{
+		if (used + bytes > maxBytes)
+			return false;
+	} while (!usedBytes.compare_exchange_weak(used, used + bytes));
+	return true;
+}
+
+FrameBufferPool::FrameBufferPool(MemoryBudget& budget)
+	: budget(budget)
+{
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+	// whatever it still accounts for, rented or free, goes back to the shared budget
+	budget.Release(totalBytes);
+}
+
+vector<BYTE> FrameBufferPool::Rent(size_t size)
+{
+	{
+		lock_guard lock(freeBuffersMutex);
+		while (!freeBuffers.empty())
+		{
+			auto buffer = move(freeBuffers.back());
+			freeBuffers.pop_back();
+			if (buffer.size() == size)
+			{
+				++rentedBuffers;
+				return buffer;
+			}
+
+			// the frame size changed, buffers of the old size are released as they come back
+			totalBytes -= buffer.size();
+			budget.Release(buffer.size());
+		}
+	}
+
+	if (!budget.TryAcquire(size))
+		return {};
+
+	totalBytes += size;
+	++rentedBuffers;
+	return vector<BYTE>(size);
+}
+
+vector<BYTE> FrameBufferPool::Rent(size_t size, const atomic<bool>& cancelled)
+{
+	for (;;)
+	{
+		if (auto buffer = Rent(size); !buffer.empty() || cancelled)
+			return buffer;
+
+		// whoever holds the rented buffers returns them even when cancelled, so this always wakes up
+		unique_lock lock(freeBuffersMutex);
+		if (freeBuffers.empty() && !rentedBuffers)
+			return {};
+		bufferReturned.wait(lock, [&] { return !freeBuffers.empty() || !rentedBuffers || cancelled; });
+	}
+}
+
+void FrameBufferPool::Return(vector<BYTE>&& buffer)
+{
+	if (buffer.empty())
+		return;
+
+	{
+		lock_guard lock(freeBuffersMutex);
+		freeBuffers.push_back(move(buffer));
+		--rentedBuffers;
+	}
+	bufferReturned.notify_all();
+}
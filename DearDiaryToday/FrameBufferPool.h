@@ -0,0 +1,41 @@
+#pragma once
+
+// a byte budget shared by several pools, so frames in flight are bounded across all the diaries recording at once
+class MemoryBudget final
+{
+	std::atomic<size_t> usedBytes{};
+	const size_t maxBytes;
+
+public:
+	MemoryBudget(size_t maxBytes) : maxBytes(maxBytes) {}
+
+	bool TryAcquire(size_t bytes);
+	void Release(size_t bytes) { usedBytes -= bytes; }
+
+	size_t GetUsedBytes() const { return usedBytes; }
+};
+
+// recycles captured frame buffers between the capture thread, which rents them, and the frame processing on the workers,
+// which returns them once the frame is encoded. The capture thread also returns the frames it drops, so the free list
+// has more than one producer
+class FrameBufferPool final
+{
+	std::mutex freeBuffersMutex;
+	std::condition_variable bufferReturned;
+	std::vector<std::vector<BYTE>> freeBuffers;
+	std::atomic<size_t> totalBytes{}, rentedBuffers{};
+	MemoryBudget& budget;
+
+public:
+	FrameBufferPool(MemoryBudget&);
+	~FrameBufferPool();
+
+	// an empty buffer means the byte budget is used up by frames still in flight, of this pool or others
+	std::vector<BYTE> Rent(size_t size);
+	// waits for rented buffers to come back while the budget is used up. An empty buffer means it was cancelled, or
+	// that the budget can't fit the buffer even with none in flight
+	std::vector<BYTE> Rent(size_t size, const std::atomic<bool>& cancelled);
+	void Return(std::vector<BYTE>&& buffer);
+
+	size_t GetTotalBytes() const { return totalBytes; }
+};
@@ -0,0 +1,156 @@
+#include "pch.h"
+#include "FrameEncoder.h"
+#include "ColorConverter.h"
+
+using namespace std;
+
+FrameEncoder::FrameEncoder(WorkerPool& workers, bool recordNv12, bool keepHdr)
+	: workers(workers), recordNv12(recordNv12), keepHdr(keepHdr)
+{
+}
+
+DiaryFrameType FrameEncoder::Encode(DiaryWriter& writer, const BYTE* data, int width, int height, int stride, DXGI_FORMAT format, int64_t timeNs)
+{
+	if (!keepHdr && format == DXGI_FORMAT_R16G16B16A16_FLOAT && height)
+	{
+		// down to 8 bits before anything else, HDR frames then cost no more to record than SDR ones
+		toneMappedFrame.resize(static_cast<size_t>(width) * height * 4);
+		auto bandCount = min(workers.GetThreadCount(), static_cast<size_t>(height));
+		workers.Run(bandCount, [&](size_t band) {
+			ToneMapHalfToBgra(data, stride, width, toneMappedFrame.data(),
+				static_cast<int>(band * height / bandCount), static_cast<int>((band + 1) * height / bandCount));
+			});
+		data = toneMappedFrame.data();
+		stride = width * 4;
+		format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	}
+
+	if (recordNv12 && format == DXGI_FORMAT_B8G8R8A8_UNORM)
+	{
+		// converted up front into a top-down frame, padded to the even size NV12 requires
+		auto roundFrameWidth = roundUp(width, 2);
+		auto roundFrameHeight = roundUp(height, 2);
+		auto layout = GetDiaryPlaneLayout(DXGI_FORMAT_NV12, roundFrameWidth, roundFrameHeight);
+		nv12Frame.resize(static_cast<size_t>(layout.width) * layout.height);
+		auto bandCount = min(workers.GetThreadCount(), static_cast<size_t>(roundFrameHeight / 2));
+		workers.Run(bandCount, [&](size_t band) {
+			ConvertBgraToNv12(data, stride, width, height, nv12Frame.data(), roundFrameWidth, roundFrameHeight,
+				static_cast<int>(band * (roundFrameHeight / 2) / bandCount) * 2, static_cast<int>((band + 1) * (roundFrameHeight / 2) / bandCount) * 2);
+			});
+		return EncodePlane(writer, { nv12Frame.data(), layout.width, layout.width, layout.height }, DXGI_FORMAT_NV12,
+			roundFrameWidth, roundFrameHeight, timeNs);
+	}
+
+	// stored as captured, the export takes care of the orientation and padding the video needs
+	return EncodePlane(writer, { data, stride, width, height }, format, width, height, timeNs);
+}
+
+DiaryFrameType FrameEncoder::EncodePlane(DiaryWriter& writer, const SourcePlane& source, DXGI_FORMAT format, int frameWidth, int frameHeight, int64_t timeNs)
+{
+	auto layout = GetDiaryPlaneLayout(format, frameWidth, frameHeight);
+	auto bytesPerPixel = layout.bytesPerPixel;
+	auto packedRowSize = static_cast<size_t>(layout.width) * bytesPerPixel;
+	auto width = source.width, height = source.height;
+
+	// the tiles are laid out over the stored plane
+	auto sizeChanged = tiles.GetWidth() != layout.width || tiles.GetHeight() != layout.height || currentFormat != format;
+	if (sizeChanged)
+	{
+		tiles = FrameTiles(layout.width, layout.height, bytesPerPixel);
+		tileHashes.assign(tiles.GetTileCount(), 0);
+		currentFrame.assign(packedRowSize * layout.height, 0);
+		currentFormat = format;
+	}
+	auto getSourceRow = [&](int y, int x) {
+		return source.firstRow + y * source.stride + x * bytesPerPixel;
+	};
+
+	// every diary file must start with a key frame, and each key frame starts a new seekable block
+	auto keyFrame = !writer.HasBlock() || sizeChanged || framesSinceKeyFrame >= KEY_FRAME_INTERVAL
+		|| timeNs - keyFrameTimeNs >= chrono::nanoseconds(MAX_DIARY_BLOCK_DURATION).count()
+		|| writer.GetBlockBytesIn() >= MAX_DIARY_BLOCK_BYTES || writer.IsBlockNearRingCapacity();
+	auto stripeCount = keyFrame ? min(workers.GetThreadCount(), tiles.GetMaxStripeCount()) : writer.GetStripeCount();
+	writer.BeginFrame(frameWidth, frameHeight, format, keyFrame, stripeCount);
+
+	tileChanged.assign(tiles.GetTileCount(), 0);
+	stripeData.resize(stripeCount);
+
+	workers.Run(stripeCount, [&](size_t stripe) {
+		auto stripeBounds = tiles.GetStripeBounds(stripe, stripeCount);
+
+		// hash the tiles straight out of the captured frame to find the ones that changed
+		size_t changedDataSize{};
+		for (auto tile = stripeBounds.firstTile; tile < stripeBounds.endTile; ++tile)
+		{
+			auto bounds = tiles.GetTileBounds(tile);
+			auto hash = FrameTiles::HashTile(getSourceRow(bounds.y, bounds.x), source.stride,
+				(min(bounds.x + bounds.width, width) - bounds.x) * bytesPerPixel, min(bounds.y + bounds.height, height) - bounds.y);
+			if (hash != tileHashes[tile])
+			{
+				tileHashes[tile] = hash;
+				tileChanged[tile] = 1;
+				changedDataSize += tiles.GetTileDataSize(tile);
+			}
+		}
+
+		auto& encoder = writer.GetStripeEncoder(stripe);
+		if (keyFrame)
+		{
+			// padding is already zeroed and never written
+			for (int y = stripeBounds.y; y < min(stripeBounds.y + stripeBounds.height, height); ++y)
+				memcpy(currentFrame.data() + y * packedRowSize, getSourceRow(y, 0), static_cast<size_t>(width) * bytesPerPixel);
+			encoder.Encode(span{ currentFrame.data() + stripeBounds.y * packedRowSize, stripeBounds.height * packedRowSize });
+		}
+		else if (changedDataSize)
+		{
+			// only the changed tiles are touched, XOR'd against the previous frame they're mostly zeroes
+			auto& tileData = stripeData[stripe];
+			tileData.resize(changedDataSize);
+			auto tileDataRow = tileData.data();
+			for (auto tile = stripeBounds.firstTile; tile < stripeBounds.endTile; ++tile)
+				if (tileChanged[tile])
+				{
+					auto bounds = tiles.GetTileBounds(tile);
+					auto tileRowSize = static_cast<size_t>(bounds.width * bytesPerPixel);
+					auto sourceRowSize = static_cast<size_t>((min(bounds.x + bounds.width, width) - bounds.x) * bytesPerPixel);
+					for (int y = bounds.y; y < bounds.y + bounds.height; ++y, tileDataRow += tileRowSize)
+					{
+						auto currentRow = currentFrame.data() + y * packedRowSize + bounds.x * bytesPerPixel;
+						if (y < height)
+						{
+							XorBytes(tileDataRow, currentRow, getSourceRow(y, bounds.x), sourceRowSize);
+							memcpy(currentRow, getSourceRow(y, bounds.x), sourceRowSize);
+							memset(tileDataRow + sourceRowSize, 0, tileRowSize - sourceRowSize);
+						}
+						else
+							memset(tileDataRow, 0, tileRowSize);
+					}
+				}
+			encoder.Encode(span{ tileData });
+		}
+		});
+
+	changedTiles.assign(tiles.GetBitmapSize(), 0);
+	size_t changedTileCount{};
+	for (size_t tile = 0; tile < tiles.GetTileCount(); ++tile)
+		if (tileChanged[tile])
+		{
+			FrameTiles::SetTileChanged(changedTiles, tile);
+			++changedTileCount;
+		}
+
+	changedTileShare = tiles.GetTileCount() ? static_cast<double>(changedTileCount) / tiles.GetTileCount() : 0;
+
+	auto frameType = keyFrame ? DiaryFrameType::Key : changedTileCount ? DiaryFrameType::Delta : DiaryFrameType::Repeat;
+	writer.EndFrame(timeNs, frameType, frameType == DiaryFrameType::Delta ? span<const BYTE>{ changedTiles } : span<const BYTE>{});
+
+	if (keyFrame)
+	{
+		framesSinceKeyFrame = 0;
+		keyFrameTimeNs = timeNs;
+	}
+	else if (frameType == DiaryFrameType::Delta)
+		++framesSinceKeyFrame;
+
+	return frameType;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "DiaryWriter.h"
+#include "FrameTiles.h"
+#include "WorkerPool.h"
+
+// blocks are the unit of retention, so they're kept short and small to evict the recording a little at a time
+constexpr int KEY_FRAME_INTERVAL = 30;
+constexpr auto MAX_DIARY_BLOCK_DURATION = std::chrono::seconds(1);
+constexpr uint64_t MAX_DIARY_BLOCK_BYTES = 64 * 1024 * 1024;		// uncompressed
+
+enum class DiaryHdrCapture : uint32_t
+{
+	Off,			// HDR windows are captured as the system maps them to SDR
+	ToneMapped,		// captured as half floats and tone mapped to BGRA before they're recorded
+	FullPrecision,	// captured and recorded as half floats, twice the data of BGRA
+};
+
+// turns captured frames into diary frame records, splitting the work into stripes across the worker pool
+class FrameEncoder final
+{
+	WorkerPool& workers;
+	const bool recordNv12, keepHdr;
+
+	FrameTiles tiles;
+	std::vector<uint64_t> tileHashes;
+	std::vector<BYTE> currentFrame, tileChanged, changedTiles;
+	std::vector<std::vector<BYTE>> stripeData;
+	std::vector<BYTE> nv12Frame, toneMappedFrame;
+	DXGI_FORMAT currentFormat{};
+
+	int framesSinceKeyFrame{};
+	int64_t keyFrameTimeNs{};
+	double changedTileShare{};
+
+	// the frame as the rows of a single plane, see GetDiaryPlaneLayout. The source can be smaller than the
+	// plane, the rest is padded with zeroes
+	struct SourcePlane
+	{
+		const BYTE* firstRow;
+		ptrdiff_t stride;
+		int width, height;
+	};
+	DiaryFrameType EncodePlane(DiaryWriter&, const SourcePlane&, DXGI_FORMAT, int frameWidth, int frameHeight, int64_t timeNs);
+
+public:
+	// half float frames are tone mapped to BGRA unless keepHdr is set, then BGRA frames are converted to NV12 before
+	// they're recorded if recordNv12 is set. Other formats are kept as-is
+	FrameEncoder(WorkerPool&, bool recordNv12 = false, bool keepHdr = false);
+
+	// the frame is top-down with the given row stride in bytes
+	DiaryFrameType Encode(DiaryWriter&, const BYTE* data, int width, int height, int stride, DXGI_FORMAT, int64_t timeNs);
+
+	// of the tiles of the last frame encoded, all of them after a size change
+	double GetChangedTileShare() const { return changedTileShare; }
+};
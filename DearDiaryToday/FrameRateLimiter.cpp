@@ -0,0 +1,38 @@
+#include "pch.h"
+#include "FrameRateLimiter.h"
+
+using namespace std;
+
+FrameRateLimiter::FrameRateLimiter(double frameRate)
+{
+	SetFrameRate(frameRate);
+}
+
+void FrameRateLimiter::SetFrameRate(double frameRate)
+{
+	frameIntervalNs = frameRate > 0 ? static_cast<int64_t>(chrono::nanoseconds(1s).count() / frameRate) : 0;
+}
+
+double FrameRateLimiter::GetFrameRate() const
+{
+	auto interval = frameIntervalNs.load();
+	return interval ? static_cast<double>(chrono::nanoseconds(1s).count()) / interval : 0;
+}
+
+bool FrameRateLimiter::TryAdmit(int64_t timeNs)
+{
+	auto interval = frameIntervalNs.load(memory_order_relaxed);
+	auto next = nextFrameTimeNs.load(memory_order_relaxed);
+
+	int64_t newNext;
+	do
+	{
+		if (timeNs < next)
+			return false;
+
+		// keep the cadence of the admitted frames unless capture fell behind it, so the average rate matches the target
+		newNext = next + interval > timeNs ? next + interval : timeNs + interval;
+	} while (!nextFrameTimeNs.compare_exchange_weak(next, newNext, memory_order_relaxed));
+
+	return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// admits frames at no more than the target rate, checked as soon as a frame arrives so the rejected ones are never
+// copied off the GPU; lock-free, can be called from any thread
+class FrameRateLimiter final
+{
+	std::atomic<int64_t> frameIntervalNs{};
+	std::atomic<int64_t> nextFrameTimeNs{ INT64_MIN };
+
+public:
+	FrameRateLimiter(double frameRate);
+
+	// 0 or less turns the limit off
+	void SetFrameRate(double frameRate);
+	double GetFrameRate() const;
+	int64_t GetFrameIntervalNs() const { return frameIntervalNs.load(std::memory_order_relaxed); }
+
+	bool TryAdmit(int64_t timeNs);
+};
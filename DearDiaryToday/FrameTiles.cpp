@@ -0,0 +1,169 @@
+#include "pch.h"
+#include "FrameTiles.h"
+
+#include <emmintrin.h>
+
+using namespace std;
+
+FrameTiles::FrameTiles(int width, int height, int bytesPerPixel)
+	: width(width), height(height), bytesPerPixel(bytesPerPixel),
+	columns((width + TILE_SIZE - 1) / TILE_SIZE), rows((height + TILE_SIZE - 1) / TILE_SIZE)
+{
+}
+
+FrameTiles::TileBounds FrameTiles::GetTileBounds(size_t tile) const
+{
+	TileBounds bounds{};
+	bounds.x = static_cast<int>(tile % columns) * TILE_SIZE;
+	bounds.y = static_cast<int>(tile / columns) * TILE_SIZE;
+	bounds.width = min(TILE_SIZE, width - bounds.x);
+	bounds.height = min(TILE_SIZE, height - bounds.y);
+	return bounds;
+}
+
+size_t FrameTiles::GetTileDataSize(size_t tile) const
+{
+	auto bounds = GetTileBounds(tile);
+	return static_cast<size_t>(bounds.width) * bounds.height * bytesPerPixel;
+}
+
+size_t FrameTiles::GetChangedTilesDataSize(span<const BYTE> bitmap, size_t firstTile, size_t endTile) const
+{
+	size_t size{};
+	for (size_t tile = firstTile; tile < endTile; ++tile)
+		if (IsTileChanged(bitmap, tile))
+			size += GetTileDataSize(tile);
+	return size;
+}
+
+FrameTiles::StripeBounds FrameTiles::GetStripeBounds(size_t stripe, size_t stripeCount) const
+{
+	auto firstRow = static_cast<int>(stripe * rows / stripeCount);
+	auto endRow = static_cast<int>((stripe + 1) * rows / stripeCount);
+
+	StripeBounds bounds{};
+	bounds.firstTile = static_cast<size_t>(firstRow) * columns;
+	bounds.endTile = static_cast<size_t>(endRow) * columns;
+	bounds.y = firstRow * TILE_SIZE;
+	bounds.height = min(endRow * TILE_SIZE, height) - bounds.y;
+	return bounds;
+}
+
+void FrameTiles::ApplyChangedTiles(span<BYTE> frame, span<const BYTE> bitmap, span<const BYTE> tileData, size_t firstTile, size_t endTile) const
+{
+	auto frameRowSize = static_cast<size_t>(width) * bytesPerPixel;
+	auto data = tileData.data();
+
+	for (size_t tile = firstTile; tile < endTile; ++tile)
+		if (IsTileChanged(bitmap, tile))
+		{
+			auto bounds = GetTileBounds(tile);
+			auto tileRowSize = static_cast<size_t>(bounds.width) * bytesPerPixel;
+			for (int y = bounds.y; y < bounds.y + bounds.height; ++y)
+			{
+				auto row = frame.data() + y * frameRowSize + bounds.x * bytesPerPixel;
+				XorBytes(row, row, data, tileRowSize);
+				data += tileRowSize;
+			}
+		}
+
+	assert(data == tileData.data() + tileData.size());
+}
+
+// xxh3-style accumulators with a per-position key so moved content hashes differently, and a
+// scramble between rows so swapped rows do too
+namespace
+{
+	constexpr int TILE_HASH_KEYS = 16;
+	constexpr uint32_t TILE_HASH_PRIME32 = 0x9E3779B1U;
+
+	constexpr array<uint64_t, TILE_HASH_KEYS * 2> MakeTileHashSecret()
+	{
+		// splitmix64
+		array<uint64_t, TILE_HASH_KEYS * 2> secret{};
+		uint64_t state = 0x2545F4914F6CDD1DULL;
+		for (auto& key : secret)
+		{
+			auto z = (state += 0x9E3779B97F4A7C15ULL);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			key = z ^ (z >> 31);
+		}
+		return secret;
+	}
+	constexpr auto tileHashSecret = MakeTileHashSecret();
+
+	inline __m128i LoadKey(size_t index)
+	{
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(tileHashSecret.data() + (index % TILE_HASH_KEYS) * 2));
+	}
+
+	inline __m128i Accumulate(__m128i acc, __m128i data, __m128i key)
+	{
+		auto dataKey = _mm_xor_si128(data, key);
+		auto product = _mm_mul_epu32(dataKey, _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1)));
+		return _mm_add_epi64(acc, _mm_add_epi64(product, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+
+	inline __m128i Scramble(__m128i acc, __m128i key)
+	{
+		acc = _mm_xor_si128(acc, _mm_srli_epi64(acc, 47));
+		acc = _mm_xor_si128(acc, key);
+		auto prime = _mm_set1_epi32(static_cast<int>(TILE_HASH_PRIME32));
+		auto low = _mm_mul_epu32(acc, prime);
+		auto high = _mm_mul_epu32(_mm_srli_epi64(acc, 32), prime);
+		return _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+	}
+}
+
+uint64_t FrameTiles::HashTile(const BYTE* firstRow, ptrdiff_t stride, size_t rowSize, int rowCount)
+{
+	auto acc0 = LoadKey(TILE_HASH_KEYS - 1), acc1 = LoadKey(TILE_HASH_KEYS - 2);
+	auto scrambleKey = LoadKey(TILE_HASH_KEYS / 2);
+
+	for (int y = 0; y < rowCount; ++y)
+	{
+		auto row = firstRow + y * stride;
+		size_t offset = 0, chunk = 0;
+		for (; offset + 32 <= rowSize; offset += 32, chunk += 2)
+		{
+			acc0 = Accumulate(acc0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + offset)), LoadKey(chunk));
+			acc1 = Accumulate(acc1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + offset + 16)), LoadKey(chunk + 1));
+		}
+		if (offset < rowSize)
+		{
+			// partial tile at the right edge of the frame
+			alignas(16) BYTE tail[32]{};
+			memcpy(tail, row + offset, rowSize - offset);
+			acc0 = Accumulate(acc0, _mm_load_si128(reinterpret_cast<const __m128i*>(tail)), LoadKey(chunk));
+			acc1 = Accumulate(acc1, _mm_load_si128(reinterpret_cast<const __m128i*>(tail + 16)), LoadKey(chunk + 1));
+		}
+
+		acc0 = Scramble(acc0, scrambleKey);
+		acc1 = Scramble(acc1, scrambleKey);
+	}
+
+	alignas(16) uint64_t lanes[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc0);
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes + 2), acc1);
+
+	// xxh64 avalanche
+	auto hash = lanes[0] ^ (lanes[1] * 0xC2B2AE3D27D4EB4FULL) ^ (lanes[2] * 0x165667B19E3779F9ULL) ^ (lanes[3] * 0x85EBCA77C2B2AE63ULL);
+	hash ^= hash >> 33;
+	hash *= 0xC2B2AE3D27D4EB4FULL;
+	hash ^= hash >> 29;
+	hash *= 0x165667B19E3779F9ULL;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+void XorBytes(BYTE* dst, const BYTE* a, const BYTE* b, size_t size)
+{
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+	for (; i < size; ++i)
+		dst[i] = a[i] ^ b[i];
+}
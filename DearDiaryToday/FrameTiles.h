@@ -0,0 +1,52 @@
+#pragma once
+
+// splits a stored frame into fixed size tiles, so only the parts that changed between frames get written
+class FrameTiles final
+{
+	int width{}, height{}, bytesPerPixel{};
+	int columns{}, rows{};
+
+public:
+	static constexpr int TILE_SIZE = 64;
+
+	struct TileBounds
+	{
+		int x, y, width, height;
+	};
+
+	// a horizontal band of whole tile rows, compressed independently of the other stripes
+	struct StripeBounds
+	{
+		size_t firstTile, endTile;
+		int y, height;
+	};
+
+	FrameTiles() = default;
+	FrameTiles(int width, int height, int bytesPerPixel);
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	size_t GetTileCount() const { return static_cast<size_t>(columns) * rows; }
+	size_t GetBitmapSize() const { return (GetTileCount() + 7) / 8; }
+
+	TileBounds GetTileBounds(size_t tile) const;
+	size_t GetTileDataSize(size_t tile) const;
+	size_t GetChangedTilesDataSize(std::span<const BYTE> bitmap) const { return GetChangedTilesDataSize(bitmap, 0, GetTileCount()); }
+	size_t GetChangedTilesDataSize(std::span<const BYTE> bitmap, size_t firstTile, size_t endTile) const;
+
+	size_t GetMaxStripeCount() const { return rows; }
+	StripeBounds GetStripeBounds(size_t stripe, size_t stripeCount) const;
+
+	// XORs the tile data of a delta record into the frame it was recorded against
+	void ApplyChangedTiles(std::span<BYTE> frame, std::span<const BYTE> bitmap, std::span<const BYTE> tileData) const { ApplyChangedTiles(frame, bitmap, tileData, 0, GetTileCount()); }
+	void ApplyChangedTiles(std::span<BYTE> frame, std::span<const BYTE> bitmap, std::span<const BYTE> tileData, size_t firstTile, size_t endTile) const;
+
+	static bool IsTileChanged(std::span<const BYTE> bitmap, size_t tile) { return bitmap[tile / 8] & (1 << (tile % 8)); }
+	static void SetTileChanged(std::span<BYTE> bitmap, size_t tile) { bitmap[tile / 8] |= 1 << (tile % 8); }
+
+	// stride can be negative to walk a bottom-up frame
+	static uint64_t HashTile(const BYTE* firstRow, ptrdiff_t stride, size_t rowSize, int rowCount);
+};
+
+// dst = a ^ b, dst can alias either input
+void XorBytes(BYTE* dst, const BYTE* a, const BYTE* b, size_t size);
@@ -0,0 +1,55 @@
+#include "pch.h"
+#include "Lz4Decoder.h"
+
+#ifdef DIARY_WITH_LZ4
+
+using namespace std;
+
+Lz4Decoder::Lz4Decoder(std::unique_ptr<DecoderInput> input, const ErrorFunc errorFunc)
+	: input(move(input)), errorFunc(errorFunc)
+{
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION)))
+		errorFunc(E_FAIL);
+}
+
+Lz4Decoder::Lz4Decoder(std::unique_ptr<std::istream> istream, const ErrorFunc errorFunc)
+	: Lz4Decoder(make_unique<StreamDecoderInput>(move(istream)), errorFunc)
+{
+}
+
+Lz4Decoder::~Lz4Decoder()
+{
+	LZ4F_freeDecompressionContext(context);
+}
+
+size_t Lz4Decoder::Decode(span<BYTE> outSpan)
+{
+	size_t outPos{};
+
+	while (outPos < outSpan.size() && !IsEof())
+	{
+		if (inPos == inBuffer.size())
+		{
+			inBuffer = input->Read();
+			inPos = 0;
+		}
+
+		// with no input left the decoder can still hold output for what it already consumed
+		auto outSize = outSpan.size() - outPos;
+		auto inUsed = inBuffer.size() - inPos;
+		auto ret = LZ4F_decompress(context, outSpan.data() + outPos, &outSize, inBuffer.data() + inPos, &inUsed, nullptr);
+		outPos += outSize;
+		inPos += inUsed;
+
+		if (LZ4F_isError(ret))
+			inputEnded = true; // if error, write what we can and stop
+		else if (ret == 0)
+			frameEnded = true;
+		else if (!outSize && !inUsed && input->IsEof())
+			inputEnded = true; // truncated
+	}
+
+	return outPos;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "StreamDecoder.h"
+
+#ifdef DIARY_WITH_LZ4
+
+class Lz4Decoder final : public StreamDecoder
+{
+	std::unique_ptr<DecoderInput> input;
+	std::span<const BYTE> inBuffer;
+	size_t inPos{};
+	const ErrorFunc errorFunc;
+	LZ4F_dctx* context{};
+	bool frameEnded{}, inputEnded{};
+
+public:
+	Lz4Decoder(std::unique_ptr<DecoderInput>, const ErrorFunc);
+	Lz4Decoder(std::unique_ptr<std::istream>, const ErrorFunc);
+	~Lz4Decoder();
+
+	// the lz4 frame ends before the input does when it's followed by other data
+	bool IsEof() const override { return frameEnded || inputEnded; }
+
+	using StreamDecoder::Decode;
+	size_t Decode(std::span<BYTE>) override;
+};
+
+#endif
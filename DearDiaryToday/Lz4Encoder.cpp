@@ -0,0 +1,76 @@
+#include "pch.h"
+#include "Lz4Encoder.h"
+
+#ifdef DIARY_WITH_LZ4
+
+using namespace std;
+
+Lz4Encoder::Lz4Encoder(int level, const ErrorFunc errorFunc)
+	: errorFunc(errorFunc)
+{
+	preferences.compressionLevel = level;
+	preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+	preferences.frameInfo.blockMode = LZ4F_blockLinked;
+
+	if (LZ4F_isError(LZ4F_createCompressionContext(&context, LZ4F_VERSION)))
+		errorFunc(E_FAIL);
+}
+
+Lz4Encoder::~Lz4Encoder()
+{
+	LZ4F_freeCompressionContext(context);
+}
+
+void Lz4Encoder::Reserve(size_t size)
+{
+	// the whole frame is kept in memory until it's finished
+	if (outSize + size > outBuffer.size())
+		outBuffer.resize((max)(outBuffer.size() * 2, outSize + size));
+}
+
+bool Lz4Encoder::Check(size_t result)
+{
+	if (LZ4F_isError(result))
+	{
+		errorFunc(S_FALSE);
+		return false;
+	}
+
+	outSize += result;
+	return true;
+}
+
+void Lz4Encoder::Encode(span<const BYTE> buffer)
+{
+	if (!frameStarted)
+	{
+		Reserve(LZ4F_HEADER_SIZE_MAX);
+		frameStarted = Check(LZ4F_compressBegin(context, outBuffer.data() + outSize, outBuffer.size() - outSize, &preferences));
+		if (!frameStarted)
+			return;
+	}
+
+	Reserve(LZ4F_compressBound(buffer.size(), &preferences));
+	if (Check(LZ4F_compressUpdate(context, outBuffer.data() + outSize, outBuffer.size() - outSize, buffer.data(), buffer.size(), nullptr)))
+		bytesIn += buffer.size();
+}
+
+span<const BYTE> Lz4Encoder::Finish()
+{
+	// an empty frame still needs its header
+	if (!frameStarted)
+		Encode(span<const BYTE>{});
+
+	Reserve(LZ4F_compressBound(0, &preferences));
+	auto finished = frameStarted && Check(LZ4F_compressEnd(context, outBuffer.data() + outSize, outBuffer.size() - outSize, nullptr));
+
+	auto size = outSize;
+	outSize = 0;
+	bytesIn = 0;
+	frameStarted = false;
+	if (!finished)
+		return {};
+	return { outBuffer.data(), size };
+}
+
+#endif
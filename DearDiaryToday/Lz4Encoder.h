@@ -0,0 +1,34 @@
+#pragma once
+
+#include "StreamEncoder.h"
+
+#ifdef DIARY_WITH_LZ4
+
+class Lz4Encoder final : public StreamEncoder
+{
+	std::vector<BYTE> outBuffer;
+	size_t outSize{};
+	uint64_t bytesIn{};
+	const ErrorFunc errorFunc;
+	LZ4F_preferences_t preferences{};
+	LZ4F_cctx* context{};
+	bool frameStarted{};
+
+	void Reserve(size_t size);
+	bool Check(size_t result);
+
+public:
+	// the level is the lz4 compression level, 0 for the fast compressor and 3 to 12 for the high compression one
+	Lz4Encoder(int level, const ErrorFunc);
+	~Lz4Encoder();
+
+	using StreamEncoder::Encode;
+	void Encode(std::span<const BYTE>) override;
+
+	uint64_t GetStreamBytesIn() const override { return bytesIn; }
+
+	// ends the lz4 frame and returns it, it stays valid until the next Encode call starts a new frame
+	std::span<const BYTE> Finish() override;
+};
+
+#endif
@@ -3,11 +3,9 @@
 
 using namespace std;
 
-LzmaDecoder::LzmaDecoder(std::unique_ptr<std::istream> istream, const ErrorFunc errorFunc)
-	: inBuffer(BUFSIZ), errorFunc(errorFunc), istream(move(istream))
+LzmaDecoder::LzmaDecoder(std::unique_ptr<DecoderInput> input, const ErrorFunc errorFunc)
+	: input(move(input)), errorFunc(errorFunc)
 {
-	inBuffer.resize(BUFSIZ);
-
 	if (lzma_stream_decoder(&stream, UINT64_MAX, 0) != LZMA_OK)
 		errorFunc(E_FAIL);
 
@@ -15,6 +13,11 @@ LzmaDecoder::LzmaDecoder(std::unique_ptr<std::istream> istream, const ErrorFunc
 	stream.avail_in = 0;
 }
 
+LzmaDecoder::LzmaDecoder(std::unique_ptr<std::istream> istream, const ErrorFunc errorFunc)
+	: LzmaDecoder(make_unique<StreamDecoderInput>(move(istream)), errorFunc)
+{
+}
+
 LzmaDecoder::~LzmaDecoder()
 {
 	lzma_end(&stream);
@@ -25,34 +28,28 @@ size_t LzmaDecoder::Decode(std::span<BYTE> outSpan)
 	stream.next_out = outSpan.data();
 	stream.avail_out = outSpan.size();
 
-	while (stream.avail_out > 0 && !istream->eof())
+	while (stream.avail_out > 0 && !streamEnded)
 	{
 		if (stream.avail_in == 0)
 		{
-			stream.next_in = inBuffer.data();
-			istream->read(reinterpret_cast<char*>(inBuffer.data()), inBuffer.size());
-			stream.avail_in = istream->gcount();
+			auto in = input->Read();
+			if (in.empty())
+				break;
+
+			stream.next_in = in.data();
+			stream.avail_in = in.size();
 		}
 
 		lzma_ret ret = lzma_code(&stream, LZMA_RUN);
 
 		if (ret == LZMA_STREAM_END)
+		{
+			streamEnded = true;
 			break;
+		}
 		if (ret != LZMA_OK)
 			break;// errorFunc(E_FAIL);		// if error, write what we can and stop
 	}
 
 	return outSpan.size() - stream.avail_out;
 }
-
-bool LzmaDecoder::Skip(size_t size)
-{
-	auto mem = _malloca(size);
-	if (!mem)
-		return false;
-
-	size_t bytesRead = Decode(std::span<BYTE>(reinterpret_cast<BYTE*>(mem), size));
-	_freea(mem);
-
-	return bytesRead == size;
-}
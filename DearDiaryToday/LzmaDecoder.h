@@ -1,26 +1,22 @@
 #pragma once
 
-class LzmaDecoder
+#include "StreamDecoder.h"
+
+class LzmaDecoder final : public StreamDecoder
 {
-	std::unique_ptr<std::istream> istream;
-	std::vector<BYTE> inBuffer;
+	std::unique_ptr<DecoderInput> input;
 	const ErrorFunc errorFunc;
 	lzma_stream stream = LZMA_STREAM_INIT;
+	bool streamEnded{};
 
 public:
+	LzmaDecoder(std::unique_ptr<DecoderInput>, const ErrorFunc);
 	LzmaDecoder(std::unique_ptr<std::istream>, const ErrorFunc);
 	~LzmaDecoder();
 
-	bool IsEof() const { return istream->eof(); }
-
-	size_t Decode(std::span<BYTE>);
+	// the xz stream ends before the input does when it's followed by other data
+	bool IsEof() const override { return streamEnded || (stream.avail_in == 0 && input->IsEof()); }
 
-	template<typename T>
-	bool Decode(T& data)
-	{
-		return Decode({ reinterpret_cast<BYTE*>(&data), sizeof(T) }) == sizeof(T);
-	}
-
-	bool Skip(size_t size);
+	using StreamDecoder::Decode;
+	size_t Decode(std::span<BYTE>) override;
 };
-
@@ -3,26 +3,36 @@
 
 using namespace std;
 
-LzmaEncoder::LzmaEncoder(std::unique_ptr<std::ostream> ostream, const ErrorFunc errorFunc)
-	: outBuffer(BUFSIZ), errorFunc(errorFunc), ostream(move(ostream))
+LzmaEncoder::LzmaEncoder(int level, const ErrorFunc errorFunc)
+	: outBuffer(BUFSIZ), errorFunc(errorFunc), preset(static_cast<uint32_t>(clamp(level, 0, 9)))
 {
-	outBuffer.resize(BUFSIZ);
+	Initialize();
+}
+
+LzmaEncoder::~LzmaEncoder()
+{
+	lzma_end(&stream);
+}
 
-	if (lzma_easy_encoder(&stream, 0, LZMA_CHECK_CRC64) != LZMA_OK)
+void LzmaEncoder::Initialize()
+{
+	if (lzma_easy_encoder(&stream, preset, LZMA_CHECK_CRC64) != LZMA_OK)
 		errorFunc(E_FAIL);
 
 	stream.next_out = outBuffer.data();
 	stream.avail_out = outBuffer.size();
 }
 
-LzmaEncoder::~LzmaEncoder()
+void LzmaEncoder::Encode(std::span<const BYTE> buffer)
 {
-	// finish the stream
+	stream.next_in = buffer.data();
+	stream.avail_in = buffer.size();
+
 	while (true)
 	{
-		auto ret = lzma_code(&stream, LZMA_FINISH);
+		auto ret = lzma_code(&stream, LZMA_RUN);
 		auto full = stream.avail_out == 0;
-		CheckOutput(true);
+		CheckOutput();
 
 		if (ret == LZMA_STREAM_END)
 			break;
@@ -31,43 +41,41 @@ LzmaEncoder::~LzmaEncoder()
 			errorFunc(S_FALSE);
 			return;
 		}
+		else if (stream.avail_in == 0 && !full)
+			break;
 	}
-
-	lzma_end(&stream);
 }
 
-void LzmaEncoder::Encode(std::span<const BYTE> buffer)
+std::span<const BYTE> LzmaEncoder::Finish()
 {
-	stream.next_in = buffer.data();
-	stream.avail_in = buffer.size();
-
 	while (true)
 	{
-		auto ret = lzma_code(&stream, LZMA_RUN);
-		auto full = stream.avail_out == 0;
-		CheckOutput(false);
+		auto ret = lzma_code(&stream, LZMA_FINISH);
+		CheckOutput();
 
 		if (ret == LZMA_STREAM_END)
 			break;
 		else if (ret != LZMA_OK)
 		{
 			errorFunc(S_FALSE);
-			return;
+			return {};
 		}
-		else if (stream.avail_in == 0 && !full)
-			break;
 	}
+
+	auto size = outBuffer.size() - stream.avail_out;
+	Initialize();
+	return { outBuffer.data(), size };
 }
 
-void LzmaEncoder::CheckOutput(bool always)
+void LzmaEncoder::CheckOutput()
 {
-	if (stream.avail_out == 0 || always)
+	if (stream.avail_out == 0)
 	{
-		size_t writeSize = outBuffer.size() - stream.avail_out;
-		if (writeSize)
-			ostream->write((char*)outBuffer.data(), writeSize);
+		// the whole stream is kept in memory until it's finished
+		auto used = outBuffer.size();
+		outBuffer.resize(used * 2);
 
-		stream.next_out = outBuffer.data();
-		stream.avail_out = outBuffer.size();
+		stream.next_out = outBuffer.data() + used;
+		stream.avail_out = outBuffer.size() - used;
 	}
 }
@@ -1,27 +1,27 @@
 #pragma once
 
-class LzmaEncoder final
+#include "StreamEncoder.h"
+
+class LzmaEncoder final : public StreamEncoder
 {
-	std::unique_ptr<std::ostream> ostream;
 	std::vector<BYTE> outBuffer;
 	const ErrorFunc errorFunc;
+	const uint32_t preset;
 	lzma_stream stream = LZMA_STREAM_INIT;
 
-	void CheckOutput(bool always);
+	void Initialize();
+	void CheckOutput();
 
 public:
-	LzmaEncoder(std::unique_ptr<std::ostream>, const ErrorFunc);
+	// the level is the xz preset, 0 to 9
+	LzmaEncoder(int level, const ErrorFunc);
 	~LzmaEncoder();
 
-	void Encode(std::span<const BYTE>);
-	void Encode(std::span<BYTE> data) { Encode({ reinterpret_cast<const BYTE*>(data.data()), data.size() }); }
-	void Encode(std::span<const char> data) { Encode({ reinterpret_cast<const BYTE*>(data.data()), data.size() }); }
-	void Encode(std::span<char> data) { Encode({ reinterpret_cast<const BYTE*>(data.data()), data.size() }); }
+	using StreamEncoder::Encode;
+	void Encode(std::span<const BYTE>) override;
 
-	template<typename T>
-	void Encode(const T& data)
-	{
-		Encode({ reinterpret_cast<const BYTE*>(&data), sizeof(T) });
-	}
-};
+	uint64_t GetStreamBytesIn() const override { return stream.total_in; }
 
+	// ends the xz stream and returns it, it stays valid until the next Encode call starts a new stream
+	std::span<const BYTE> Finish() override;
+};
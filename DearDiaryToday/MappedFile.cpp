@@ -0,0 +1,59 @@
+#include "pch.h"
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile(const filesystem::path& path)
+{
+#ifdef _WIN32
+	// the file can still be written to, a diary ring is mapped by its writer as well
+	file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER fileSize{};
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || !fileSize.QuadPart
+		|| !(mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr)))
+		return;
+
+	view = static_cast<const BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (view)
+		size = static_cast<uint64_t>(fileSize.QuadPart);
+#else
+	file = open(path.c_str(), O_RDONLY);
+	struct stat fileStat {};
+	if (file < 0 || fstat(file, &fileStat) != 0 || !fileStat.st_size)
+		return;
+
+	auto mapped = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_SHARED, file, 0);
+	if (mapped == MAP_FAILED)
+		return;
+
+	// the streams are decoded front to back, so the kernel can read ahead
+	madvise(mapped, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+	view = static_cast<const BYTE*>(mapped);
+	size = static_cast<uint64_t>(fileStat.st_size);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (view)
+		UnmapViewOfFile(view);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+#else
+	if (view)
+		munmap(const_cast<BYTE*>(view), static_cast<size_t>(size));
+	if (file >= 0)
+		close(file);
+#endif
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// a whole file mapped read-only, which readers can hand straight to the decoders
+class MappedFile final
+{
+	const BYTE* view{};
+	uint64_t size{};
+
+#ifdef _WIN32
+	HANDLE file{ INVALID_HANDLE_VALUE }, mapping{};
+#else
+	int file{ -1 };
+#endif
+
+public:
+	// empty if the file couldn't be mapped, or is empty
+	MappedFile(const std::filesystem::path&);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	std::span<const BYTE> GetData() const { return { view, static_cast<size_t>(size) }; }
+};
@@ -0,0 +1,41 @@
+#include "pch.h"
+#include "PipelineStatistics.h"
+
+using namespace std;
+
+void LatencyHistogram::Record(hr_clock::duration latency)
+{
+	auto ns = latency.count() > 0 ? static_cast<uint64_t>(duration_cast<chrono::nanoseconds>(latency).count()) : 0;
+	auto bucket = (min)(static_cast<int>(bit_width(ns / 1000)), DIARY_LATENCY_BUCKET_COUNT - 1);
+
+	buckets[bucket].fetch_add(1, memory_order_relaxed);
+	count.fetch_add(1, memory_order_relaxed);
+	totalNs.fetch_add(ns, memory_order_relaxed);
+
+	auto currentMax = maxNs.load(memory_order_relaxed);
+	while (ns > currentMax && !maxNs.compare_exchange_weak(currentMax, ns, memory_order_relaxed));
+}
+
+void LatencyHistogram::Snapshot(DiaryLatencyHistogram& histogram) const
+{
+	histogram.count = count.load(memory_order_relaxed);
+	histogram.totalNs = totalNs.load(memory_order_relaxed);
+	histogram.maxNs = maxNs.load(memory_order_relaxed);
+	for (int i = 0; i < DIARY_LATENCY_BUCKET_COUNT; ++i)
+		histogram.buckets[i] = buckets[i].load(memory_order_relaxed);
+}
+
+void PipelineStatistics::Snapshot(DiaryStatistics& statistics) const
+{
+	statistics.framesCaptured = framesCaptured.load(memory_order_relaxed);
+	statistics.framesRateLimited = framesRateLimited.load(memory_order_relaxed);
+	statistics.framesDropped = framesDropped.load(memory_order_relaxed);
+	statistics.framesDroppedNoBuffer = framesDroppedNoBuffer.load(memory_order_relaxed);
+	statistics.framesDroppedBlockTooLarge = framesDroppedBlockTooLarge.load(memory_order_relaxed);
+	statistics.framesEncoded = framesEncoded.load(memory_order_relaxed);
+	statistics.encoderBytesIn = encoderBytesIn.load(memory_order_relaxed);
+	statistics.encoderBytesOut = encoderBytesOut.load(memory_order_relaxed);
+	copyLatency.Snapshot(statistics.copyLatency);
+	encodeLatency.Snapshot(statistics.encodeLatency);
+	writeLatency.Snapshot(statistics.writeLatency);
+}
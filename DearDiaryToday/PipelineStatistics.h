@@ -0,0 +1,54 @@
+#pragma once
+
+// bucket i counts latencies of at least 2^(i-1) and under 2^i microseconds, bucket 0 those under a microsecond and
+// the last bucket everything longer
+constexpr int DIARY_LATENCY_BUCKET_COUNT = 20;
+
+// the structures returned by GetDiaryStatistics, mirrored in DearDiaryTodayCs
+extern "C" {
+	struct DiaryLatencyHistogram
+	{
+		uint64_t count, totalNs, maxNs;
+		uint64_t buckets[DIARY_LATENCY_BUCKET_COUNT];
+	};
+
+	struct DiaryStatistics
+	{
+		uint64_t framesCaptured;			// every frame the capture session delivered
+		uint64_t framesRateLimited;			// rejected by the frame rate limiter
+		uint64_t framesDropped;				// the frame queue was full
+		uint64_t framesDroppedNoBuffer;		// the frame buffer pool was out of budget
+		uint64_t framesDroppedBlockTooLarge;	// encoded into a block larger than the whole diary ring
+		uint64_t framesEncoded;
+		uint64_t queueDepth;
+		uint64_t frameBufferPoolBytes;
+		uint64_t encoderBytesIn, encoderBytesOut;
+		DiaryLatencyHistogram copyLatency;		// staging copy, map and copy into the frame queue
+		DiaryLatencyHistogram encodeLatency;	// the whole frame, including finishing and writing blocks
+		DiaryLatencyHistogram writeLatency;		// handing finished blocks to the writer thread of the diary file or ring
+	};
+}
+
+class LatencyHistogram final
+{
+	std::atomic<uint64_t> count{}, totalNs{}, maxNs{};
+	std::array<std::atomic<uint64_t>, DIARY_LATENCY_BUCKET_COUNT> buckets{};
+
+public:
+	void Record(hr_clock::duration);
+	void Snapshot(DiaryLatencyHistogram&) const;
+};
+
+// lock-free counters for the recording pipeline, cheap enough to always keep on
+struct PipelineStatistics final
+{
+	std::atomic<uint64_t> framesCaptured{}, framesRateLimited{}, framesDropped{}, framesDroppedNoBuffer{}, framesDroppedBlockTooLarge{},
+		framesEncoded{};
+	std::atomic<uint64_t> encoderBytesIn{}, encoderBytesOut{};
+	LatencyHistogram copyLatency, encodeLatency, writeLatency;
+
+	static void Add(std::atomic<uint64_t>& counter, uint64_t value = 1) { counter.fetch_add(value, std::memory_order_relaxed); }
+
+	// everything but the queue depth and the pool size, which the owner of those fills in
+	void Snapshot(DiaryStatistics&) const;
+};
@@ -0,0 +1,43 @@
+#include "pch.h"
+#include "StreamDecoder.h"
+#include "LzmaDecoder.h"
+#include "ZstdDecoder.h"
+#include "Lz4Decoder.h"
+
+using namespace std;
+
+unique_ptr<StreamDecoder> StreamDecoder::Create(DiaryCodec codec, unique_ptr<DecoderInput> input, const ErrorFunc errorFunc)
+{
+	switch (codec)
+	{
+	case DiaryCodec::Lzma: return make_unique<LzmaDecoder>(move(input), errorFunc);
+#ifdef DIARY_WITH_ZSTD
+	case DiaryCodec::Zstd: return make_unique<ZstdDecoder>(move(input), errorFunc);
+#endif
+#ifdef DIARY_WITH_LZ4
+	case DiaryCodec::Lz4: return make_unique<Lz4Decoder>(move(input), errorFunc);
+#endif
+	default:
+		errorFunc(E_NOTIMPL);
+		return nullptr;
+	}
+}
+
+unique_ptr<StreamDecoder> StreamDecoder::Create(DiaryCodec codec, unique_ptr<istream> istream, const ErrorFunc errorFunc)
+{
+	return Create(codec, make_unique<StreamDecoderInput>(move(istream)), errorFunc);
+}
+
+bool StreamDecoder::Skip(size_t size)
+{
+	skipBuffer.resize(min(size, DECODER_SKIP_BUFFER_SIZE));
+	while (size)
+	{
+		auto chunk = min(size, skipBuffer.size());
+		if (Decode(span{ skipBuffer.data(), chunk }) != chunk)
+			return false;
+		size -= chunk;
+	}
+
+	return true;
+}
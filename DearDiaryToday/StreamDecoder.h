@@ -0,0 +1,31 @@
+#pragma once
+
+#include "DiaryFormat.h"
+#include "DecoderInput.h"
+
+// decompresses a single stream read from the input, which can be followed by unrelated data
+class StreamDecoder
+{
+	std::vector<BYTE> skipBuffer;
+
+public:
+	virtual ~StreamDecoder() = default;
+
+	// nullptr if the codec isn't supported by this build
+	static std::unique_ptr<StreamDecoder> Create(DiaryCodec, std::unique_ptr<DecoderInput>, const ErrorFunc);
+	static std::unique_ptr<StreamDecoder> Create(DiaryCodec, std::unique_ptr<std::istream>, const ErrorFunc);
+
+	// the stream ended, or the input ended before it did
+	virtual bool IsEof() const = 0;
+
+	virtual size_t Decode(std::span<BYTE>) = 0;
+
+	template<typename T>
+	bool Decode(T& data)
+	{
+		return Decode({ reinterpret_cast<BYTE*>(&data), sizeof(T) }) == sizeof(T);
+	}
+
+	// decodes and drops size bytes through a small scratch buffer, whatever their size
+	bool Skip(size_t size);
+};
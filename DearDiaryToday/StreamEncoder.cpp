@@ -0,0 +1,38 @@
+#include "pch.h"
+#include "StreamEncoder.h"
+#include "LzmaEncoder.h"
+#include "ZstdEncoder.h"
+#include "Lz4Encoder.h"
+
+using namespace std;
+
+bool StreamEncoder::IsSupported(DiaryCodec codec)
+{
+	switch (codec)
+	{
+	case DiaryCodec::Lzma: return true;
+#ifdef DIARY_WITH_ZSTD
+	case DiaryCodec::Zstd: return true;
+#endif
+#ifdef DIARY_WITH_LZ4
+	case DiaryCodec::Lz4: return true;
+#endif
+	default: return false;
+	}
+}
+
+unique_ptr<StreamEncoder> StreamEncoder::Create(StreamCodec codec, const ErrorFunc errorFunc)
+{
+	switch (codec.codec)
+	{
+#ifdef DIARY_WITH_ZSTD
+	case DiaryCodec::Zstd: return make_unique<ZstdEncoder>(codec.level, errorFunc);
+#endif
+#ifdef DIARY_WITH_LZ4
+	case DiaryCodec::Lz4: return make_unique<Lz4Encoder>(codec.level, errorFunc);
+#endif
+	default:
+		assert(codec.codec == DiaryCodec::Lzma);
+		return make_unique<LzmaEncoder>(codec.level, errorFunc);
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "DiaryFormat.h"
+
+// the codec and its level, 0 picks the codec's default
+struct StreamCodec
+{
+	DiaryCodec codec = DiaryCodec::Lzma;
+	int level = 0;
+};
+
+// compresses a stream into memory, one self-contained compressed stream per Finish call
+class StreamEncoder
+{
+public:
+	virtual ~StreamEncoder() = default;
+
+	static bool IsSupported(DiaryCodec);
+	static std::unique_ptr<StreamEncoder> Create(StreamCodec, const ErrorFunc);
+
+	virtual void Encode(std::span<const BYTE>) = 0;
+	void Encode(std::span<BYTE> data) { Encode({ reinterpret_cast<const BYTE*>(data.data()), data.size() }); }
+	void Encode(std::span<const char> data) { Encode({ reinterpret_cast<const BYTE*>(data.data()), data.size() }); }
+	void Encode(std::span<char> data) { Encode({ reinterpret_cast<const BYTE*>(data.data()), data.size() }); }
+
+	template<typename T>
+	void Encode(const T& data)
+	{
+		Encode({ reinterpret_cast<const BYTE*>(&data), sizeof(T) });
+	}
+
+	// uncompressed bytes of the current stream
+	virtual uint64_t GetStreamBytesIn() const = 0;
+
+	// ends the stream and returns it, it stays valid until the next Encode call starts a new stream
+	virtual std::span<const BYTE> Finish() = 0;
+};
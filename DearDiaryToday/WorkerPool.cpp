@@ -0,0 +1,105 @@
+#include "pch.h"
+#include "WorkerPool.h"
+
+using namespace std;
+
+WorkerPool::WorkerPool(size_t threadCount)
+{
+	for (size_t i = 1; i < threadCount; ++i)
+		threads.emplace_back([this] {
+			unique_lock lock(workMutex);
+
+			while (true)
+			{
+				Job* job{};
+				workReady.wait(lock, [&] { return stopping || (job = FindJob()) || !tasks.empty(); });
+				if (stopping)
+					return;
+
+				// work items first, someone is waiting on them
+				if (job)
+					RunWorkItem(*job, lock);
+				else
+				{
+					auto task = move(tasks.front());
+					tasks.pop_front();
+
+					lock.unlock();
+					task();
+					lock.lock();
+				}
+			}
+			});
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		lock_guard lock(workMutex);
+		stopping = true;
+	}
+	workReady.notify_all();
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+void WorkerPool::Run(size_t count, const function<void(size_t)>& work)
+{
+	if (!count)
+		return;
+
+	Job job{ &work, count, 0, count };
+	unique_lock lock(workMutex);
+	jobs.push_back(&job);
+	workReady.notify_all();
+
+	// the caller only runs its own items, it's never held up by another caller's
+	while (job.next < job.count)
+		RunWorkItem(job, lock);
+	workDone.wait(lock, [&] { return job.pending == 0; });
+
+	jobs.erase(find(jobs.begin(), jobs.end(), &job));
+}
+
+void WorkerPool::Submit(function<void()> task)
+{
+	if (threads.empty())
+	{
+		task();
+		return;
+	}
+
+	{
+		lock_guard lock(workMutex);
+		tasks.push_back(move(task));
+	}
+	workReady.notify_one();
+}
+
+WorkerPool::Job* WorkerPool::FindJob()
+{
+	// round robin, one item at a time
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		auto index = (nextJob + i) % jobs.size();
+		if (jobs[index]->next < jobs[index]->count)
+		{
+			nextJob = index + 1;
+			return jobs[index];
+		}
+	}
+	return nullptr;
+}
+
+void WorkerPool::RunWorkItem(Job& job, unique_lock<mutex>& lock)
+{
+	auto index = job.next++;
+
+	lock.unlock();
+	(*job.work)(index);
+	lock.lock();
+
+	if (--job.pending == 0)
+		workDone.notify_all();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// a fixed set of threads that run indexed work items and queued tasks, shared by everything that records or exports.
+// Run can be called from several threads at once, tasks and work items included: each caller works through its own
+// items while the threads with nothing else to do take items from all the callers in turn, so every caller gets a
+// fair share of the threads however many items it has
+class WorkerPool final
+{
+	struct Job
+	{
+		const std::function<void(size_t)>* work;
+		size_t count, next, pending;
+	};
+
+	std::vector<std::thread> threads;
+	std::mutex workMutex;
+	std::condition_variable workReady, workDone;
+
+	std::vector<Job*> jobs;		// of the Run calls in progress
+	size_t nextJob{};			// the job the threads take their next item from
+	std::deque<std::function<void()>> tasks;
+	bool stopping{};
+
+	Job* FindJob();
+	void RunWorkItem(Job&, std::unique_lock<std::mutex>&);
+
+public:
+	WorkerPool(size_t threadCount = std::thread::hardware_concurrency());
+	// the tasks that didn't start yet are dropped
+	~WorkerPool();
+
+	// includes the calling thread
+	size_t GetThreadCount() const { return threads.size() + 1; }
+
+	void Run(size_t count, const std::function<void(size_t)>& work);
+
+	// runs the task on one of the threads, in the order they were queued once the threads are done with the work items
+	// in progress, or right away on the calling thread if the pool has no threads of its own
+	void Submit(std::function<void()>);
+};
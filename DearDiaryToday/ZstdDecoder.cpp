@@ -0,0 +1,53 @@
+#include "pch.h"
+#include "ZstdDecoder.h"
+
+#ifdef DIARY_WITH_ZSTD
+
+using namespace std;
+
+ZstdDecoder::ZstdDecoder(std::unique_ptr<DecoderInput> input, const ErrorFunc errorFunc)
+	: input(move(input)), errorFunc(errorFunc), context(ZSTD_createDCtx())
+{
+	if (!context)
+		errorFunc(E_FAIL);
+}
+
+ZstdDecoder::ZstdDecoder(std::unique_ptr<std::istream> istream, const ErrorFunc errorFunc)
+	: ZstdDecoder(make_unique<StreamDecoderInput>(move(istream)), errorFunc)
+{
+}
+
+ZstdDecoder::~ZstdDecoder()
+{
+	ZSTD_freeDCtx(context);
+}
+
+size_t ZstdDecoder::Decode(span<BYTE> outSpan)
+{
+	ZSTD_outBuffer output{ outSpan.data(), outSpan.size(), 0 };
+
+	while (output.pos < output.size && !IsEof())
+	{
+		if (inBuffer.pos == inBuffer.size)
+		{
+			auto in = input->Read();
+			inBuffer = { in.data(), in.size(), 0 };
+		}
+
+		// with no input left the decoder can still hold output for what it already consumed
+		auto inputPos = inBuffer.pos;
+		auto outputPos = output.pos;
+		auto ret = ZSTD_decompressStream(context, &output, &inBuffer);
+
+		if (ZSTD_isError(ret))
+			inputEnded = true; // if error, write what we can and stop
+		else if (ret == 0)
+			frameEnded = true;
+		else if (inBuffer.pos == inputPos && output.pos == outputPos && input->IsEof())
+			inputEnded = true; // truncated
+	}
+
+	return output.pos;
+}
+
+#endif
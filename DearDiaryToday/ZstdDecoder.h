@@ -0,0 +1,27 @@
+#pragma once
+
+#include "StreamDecoder.h"
+
+#ifdef DIARY_WITH_ZSTD
+
+class ZstdDecoder final : public StreamDecoder
+{
+	std::unique_ptr<DecoderInput> input;
+	ZSTD_inBuffer inBuffer{};
+	const ErrorFunc errorFunc;
+	ZSTD_DCtx* context;
+	bool frameEnded{}, inputEnded{};
+
+public:
+	ZstdDecoder(std::unique_ptr<DecoderInput>, const ErrorFunc);
+	ZstdDecoder(std::unique_ptr<std::istream>, const ErrorFunc);
+	~ZstdDecoder();
+
+	// the zstd frame ends before the input does when it's followed by other data
+	bool IsEof() const override { return frameEnded || inputEnded; }
+
+	using StreamDecoder::Decode;
+	size_t Decode(std::span<BYTE>) override;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "pch.h"
+#include "ZstdEncoder.h"
+
+#ifdef DIARY_WITH_ZSTD
+
+using namespace std;
+
+ZstdEncoder::ZstdEncoder(int level, const ErrorFunc errorFunc)
+	: outBuffer(ZSTD_CStreamOutSize()), errorFunc(errorFunc), context(ZSTD_createCCtx())
+{
+	if (!context
+		|| ZSTD_isError(ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level))
+		|| ZSTD_isError(ZSTD_CCtx_setParameter(context, ZSTD_c_checksumFlag, 1)))
+		errorFunc(E_FAIL);
+}
+
+ZstdEncoder::~ZstdEncoder()
+{
+	ZSTD_freeCCtx(context);
+}
+
+bool ZstdEncoder::Compress(ZSTD_inBuffer& input, ZSTD_EndDirective directive)
+{
+	while (true)
+	{
+		// the whole frame is kept in memory until it's finished
+		if (outSize == outBuffer.size())
+			outBuffer.resize(outBuffer.size() * 2);
+
+		ZSTD_outBuffer output{ outBuffer.data(), outBuffer.size(), outSize };
+		auto remaining = ZSTD_compressStream2(context, &output, &input, directive);
+		outSize = output.pos;
+
+		if (ZSTD_isError(remaining))
+		{
+			errorFunc(S_FALSE);
+			return false;
+		}
+
+		// continuing is done once the input is consumed, ending once nothing is left to flush
+		if (directive == ZSTD_e_continue ? input.pos == input.size : remaining == 0)
+			return true;
+	}
+}
+
+void ZstdEncoder::Encode(span<const BYTE> buffer)
+{
+	ZSTD_inBuffer input{ buffer.data(), buffer.size(), 0 };
+	Compress(input, ZSTD_e_continue);
+	bytesIn += buffer.size();
+}
+
+span<const BYTE> ZstdEncoder::Finish()
+{
+	ZSTD_inBuffer input{ nullptr, 0, 0 };
+	auto finished = Compress(input, ZSTD_e_end);
+
+	auto size = outSize;
+	outSize = 0;
+	bytesIn = 0;
+	if (!finished)
+	{
+		ZSTD_CCtx_reset(context, ZSTD_reset_session_only);
+		return {};
+	}
+	return { outBuffer.data(), size };
+}
+
+#endif
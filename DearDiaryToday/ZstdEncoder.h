@@ -0,0 +1,31 @@
+#pragma once
+
+#include "StreamEncoder.h"
+
+#ifdef DIARY_WITH_ZSTD
+
+class ZstdEncoder final : public StreamEncoder
+{
+	std::vector<BYTE> outBuffer;
+	size_t outSize{};
+	uint64_t bytesIn{};
+	const ErrorFunc errorFunc;
+	ZSTD_CCtx* context;
+
+	bool Compress(ZSTD_inBuffer&, ZSTD_EndDirective);
+
+public:
+	// the level is the zstd compression level, negative levels trade ratio for even more speed
+	ZstdEncoder(int level, const ErrorFunc);
+	~ZstdEncoder();
+
+	using StreamEncoder::Encode;
+	void Encode(std::span<const BYTE>) override;
+
+	uint64_t GetStreamBytesIn() const override { return bytesIn; }
+
+	// ends the zstd frame and returns it, it stays valid until the next Encode call starts a new frame
+	std::span<const BYTE> Finish() override;
+};
+
+#endif
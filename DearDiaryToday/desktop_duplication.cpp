@@ -1,6 +1,6 @@
 #include "pch.h"
 #include "desktop_duplication.h"
-#include "LzmaDecoder.h"
+#include "ColorConverter.h"
 
 using namespace ATL;
 using namespace std;
@@ -13,127 +13,180 @@ using namespace Windows::Graphics::Capture;
 using namespace Windows::Graphics::DirectX;
 using namespace Windows::Graphics::DirectX::Direct3D11;
 
-com_ptr<DesktopDuplication> desktopDuplicationInstance;
+DiaryHandle defaultDiary{};
+double diaryFrameRate = MAX_FRAME_RATE;
 
-bool __stdcall InitializeDiary(ErrorFunc _errorFunc)
-{
-	MFStartup(MF_VERSION);
-	desktopDuplicationInstance = make_self<DesktopDuplication>(_errorFunc);
+// the rings of the diaries still stopping, they delete their ring once they're done with it
+static mutex stoppingRingsMutex;
+static condition_variable ringStopped;
+static multiset<filesystem::path> stoppingRings;
 
-	for (int i = 0; i < MAX_DIARY_FILES; ++i)
-	{
-		auto diaryFilePath = DesktopDuplication::GetDiaryFilePath(i, false);
-		if (filesystem::exists(diaryFilePath))
-			return true; // found a diary file
-	}
-	return false; // no diary files found
+// a handle holds a reference to its diary
+static DesktopDuplication* FromHandle(DiaryHandle diary)
+{
+	return reinterpret_cast<DesktopDuplication*>(diary);
 }
 
-void StartDiary(HWND hWnd)
+bool __stdcall InitializeDiary(ErrorFunc _errorFunc, const DiaryOptions* options)
 {
-	// delete all left over diary files
-	for (int i = 0; i < MAX_DIARY_FILES; ++i)
-	{
-		auto diaryFilePath = DesktopDuplication::GetDiaryFilePath(i, false);
+	// the new diary opens once the old one has deleted the ring they share
+	if (defaultDiary)
+		DiaryStop(exchange(defaultDiary, nullptr), [](void*) {}, nullptr);
 
-		error_code ec;
-		filesystem::remove(diaryFilePath, ec);
-	}
+	auto leftOver = OpenDiary(nullptr, _errorFunc, options, &defaultDiary);
+	DiarySetFrameRate(defaultDiary, diaryFrameRate);
+	return leftOver;
+}
 
-	desktopDuplicationInstance->Start(hWnd);
+void StartDiary(HWND hWnd)
+{
+	DiaryStart(defaultDiary, hWnd);
 }
 
 void ExportDiaryVideo(LPWSTR outputPath, ExportDiaryVideoCompletion completion, void* completionArg)
 {
-	desktopDuplicationInstance->ExportVideo(outputPath, completion, completionArg);
+	ExportDiaryVideoRange(outputPath, nullptr, completion, completionArg);
+}
+
+void __stdcall ExportDiaryVideoRange(LPWSTR outputPath, const DiaryExportRange* range, ExportDiaryVideoCompletion completion, void* completionArg)
+{
+	DiaryExportVideo(defaultDiary, outputPath, range, completion, completionArg);
 }
 
 void __stdcall StopDiary(StopDiaryCompletion completion, void* completionArg)
 {
-	if (!desktopDuplicationInstance)
+	if (!defaultDiary)
 		return; // nothing to stop
 
-	thread([=] {
-		desktopDuplicationInstance->StopDiaryAndWait();
-		desktopDuplicationInstance = nullptr;
-		completion(completionArg);
-		}).detach();
+	DiaryStop(exchange(defaultDiary, nullptr), completion, completionArg);
 }
 
-#define CHECK_PTR(ptr) do { if (!ptr) { errorFunc(S_FALSE); return; } } while (false)
-#define CHECK_HR(hr) do { if (FAILED(hr)) { errorFunc(hr); return; } } while (false)
-#define CHECK_HR_RET(hr) do { if (FAILED(hr)) { errorFunc(hr); return hr; } } while (false)
-#define CHECK_HR_CR(hr) do { if (FAILED(hr)) { errorFunc(hr); co_return; } } while (false)
+void __stdcall SetDiaryFrameRate(double frameRate)
+{
+	// remembered for the next InitializeDiary as well
+	diaryFrameRate = frameRate;
+	if (defaultDiary)
+		DiarySetFrameRate(defaultDiary, frameRate);
+}
 
-DesktopDuplication::DesktopDuplication(ErrorFunc errorFunc)
-	: errorFunc(errorFunc)
+void __stdcall GetDiaryStatistics(DiaryStatistics* statistics)
 {
-	InitializeCriticalSection(&fileAccessCriticalSection);
+	*statistics = {};
+	if (defaultDiary)
+		DiaryGetStatistics(defaultDiary, statistics);
+}
 
-	frameProcessingThread = thread([=] {
-		hr_time_point frameTimePoint{};
-		int outputFileFrameCount{};
+bool __stdcall OpenDiary(LPCWSTR name, ErrorFunc _errorFunc, const DiaryOptions* options, DiaryHandle* diary)
+{
+	StreamCodec codec{};
+	auto recordNv12 = false;
+	auto hdrCapture = DiaryHdrCapture::Off;
+	auto maxDiaryBytes = DEFAULT_DIARY_RING_BYTES;
+	chrono::nanoseconds maxDiaryDuration = DEFAULT_DIARY_DURATION;
+	auto minFrameRate = DEFAULT_MIN_FRAME_RATE;
+	size_t maxFrameBufferBytes = MAX_FRAME_BUFFER_POOL_BYTES;
+	if (options)
+	{
+		recordNv12 = options->recordNv12;
+		hdrCapture = options->hdrCapture;
+		if (options->maxDiaryBytes)
+			maxDiaryBytes = options->maxDiaryBytes;
+		if (options->maxDiarySeconds)
+			maxDiaryDuration = options->maxDiarySeconds < 0 ? chrono::nanoseconds{}
+				: chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double>(options->maxDiarySeconds));
+		if (options->minFrameRate)
+			minFrameRate = options->minFrameRate;
+		if (options->maxFrameBufferBytes)
+			maxFrameBufferBytes = static_cast<size_t>(options->maxFrameBufferBytes);
+		if (StreamEncoder::IsSupported(options->codec))
+			codec = { options->codec, options->codecLevel };
+		else
+			_errorFunc(E_NOTIMPL);
+	}
 
-		while (!stopping)
-		{
-			FrameData frameData;
-			while (!stopping && frames.try_dequeue(frameData))
-			{
-				if (outputFileFrameCount == 0) frameTimePoint = frameData.now;
+	// a diary of the same name that's still stopping would delete this one's ring from under it
+	auto ringPath = DesktopDuplication::GetDiaryRingPath(name);
+	{
+		unique_lock lock(stoppingRingsMutex);
+		ringStopped.wait(lock, [&] { return !stoppingRings.contains(ringPath); });
+	}
 
-				auto time_span_ns = duration_cast<chrono::nanoseconds> (frameData.now - frameTimePoint).count();
+	MFStartup(MF_VERSION);
+	auto instance = make_self<DesktopDuplication>(_errorFunc, move(ringPath), codec, recordNv12,
+		hdrCapture, maxDiaryBytes, maxDiaryDuration, minFrameRate, maxFrameBufferBytes);
+	auto leftOver = instance->HasLeftOverDiary();
+	*diary = reinterpret_cast<DiaryHandle>(instance.detach());
+	return leftOver;
+}
 
-				// frame rate limiter
-				if (outputFileFrameCount == 0 || time_span_ns >= 1.0 / MAX_FRAME_RATE * chrono::nanoseconds(1s).count())
-				{
-					// NV12 requires the height to be a multiple of 2, and we might as well do it here
-					auto roundFrameWidth = roundUp(frameData.width, 2);
-					auto roundFrameHeight = roundUp(frameData.height, 2);
+void __stdcall DiaryStart(DiaryHandle diary, HWND hWnd)
+{
+	// the ring is recreated empty when recording starts, so whatever is left over is discarded
+	FromHandle(diary)->Start(hWnd);
+}
 
-					EnterCriticalSection(&fileAccessCriticalSection);
-					lzmaEncoder->Encode(roundFrameWidth);
-					lzmaEncoder->Encode(roundFrameHeight);
-					lzmaEncoder->Encode(frameData.format);
-					lzmaEncoder->Encode(time_span_ns);
+void __stdcall DiaryExportVideo(DiaryHandle diary, LPWSTR outputPath, const DiaryExportRange* range, ExportDiaryVideoCompletion completion,
+	void* completionArg)
+{
+	FromHandle(diary)->ExportVideo(outputPath, range ? *range : DiaryExportRange{ -1, 0 }, completion, completionArg);
+}
 
-					for (int y = 0; y < frameData.height; ++y)
-					{
-						lzmaEncoder->Encode({
-							reinterpret_cast<const BYTE*>(frameData.data.data()) + (frameData.height - y - 1) * frameData.stride,
-							static_cast<size_t>(frameData.width * 4) });
-						if (frameData.width < roundFrameWidth)
-						{
-							// pad end of row if necessary
-							lzmaEncoder->Encode(uint32_t{});
-						}
-					}
-					if (frameData.height < roundFrameHeight)
-					{
-						// pad end of frame if necessary
-						char* row = (char*)_malloca(roundFrameWidth * 4);
-						assert(row);
-						memset(row, 0, roundFrameWidth * 4);
-						lzmaEncoder->Encode(span{ row, static_cast<size_t>(roundFrameWidth * 4) });
-						_freea(row);
-					}
+void __stdcall DiaryStop(DiaryHandle diary, StopDiaryCompletion completion, void* completionArg)
+{
+	com_ptr<DesktopDuplication> instance;
+	instance.attach(FromHandle(diary));
+
+	{
+		lock_guard lock(stoppingRingsMutex);
+		stoppingRings.insert(instance->GetRingPath());
+	}
+
+	thread([=] {
+		instance->StopDiaryAndWait();
+		{
+			lock_guard lock(stoppingRingsMutex);
+			stoppingRings.erase(stoppingRings.find(instance->GetRingPath()));
+		}
+		ringStopped.notify_all();
+		completion(completionArg);
+		}).detach();
+}
 
-					LeaveCriticalSection(&fileAccessCriticalSection);
+void __stdcall DiarySetFrameRate(DiaryHandle diary, double frameRate)
+{
+	FromHandle(diary)->SetFrameRate(frameRate);
+}
 
-					++outputFileFrameCount;
-					frameTimePoint = frameData.now;
+void __stdcall DiaryGetStatistics(DiaryHandle diary, DiaryStatistics* statistics)
+{
+	*statistics = {};
+	FromHandle(diary)->GetStatistics(*statistics);
+}
 
-					// file switch?
-					if (outputFileFrameCount > MAX_FRAMES_PER_DIARY_FILE)
-					{
-						OpenNextOutputFile();
-						outputFileFrameCount = 0;
-					}
-				}
-			}
+shared_ptr<DiaryResources> DiaryResources::GetShared(size_t maxFrameBufferBytes)
+{
+	static mutex sharedMutex;
+	static weak_ptr<DiaryResources> shared;
+
+	lock_guard lock(sharedMutex);
+	auto resources = shared.lock();
+	if (!resources)
+		shared = resources = make_shared<DiaryResources>(maxFrameBufferBytes);
+	return resources;
+}
 
-			WaitForSingleObject(newFrameReadyEvent.get(), 10);
-		}
-		});
+#define CHECK_PTR(ptr) do { if (!ptr) { errorFunc(S_FALSE); return; } } while (false)
+#define CHECK_HR(hr) do { if (FAILED(hr)) { errorFunc(hr); return; } } while (false)
+#define CHECK_HR_RET(hr) do { if (FAILED(hr)) { errorFunc(hr); return hr; } } while (false)
+#define CHECK_HR_CR(hr) do { if (FAILED(hr)) { errorFunc(hr); co_return; } } while (false)
+
+DesktopDuplication::DesktopDuplication(ErrorFunc errorFunc, filesystem::path ringPath, StreamCodec codec, bool recordNv12,
+	DiaryHdrCapture hdrCapture, uint64_t maxDiaryBytes, chrono::nanoseconds maxDiaryDuration, double minFrameRate, size_t maxFrameBufferBytes)
+	: errorFunc(errorFunc), codec(codec), hdrCapture(hdrCapture), maxDiaryBytes(maxDiaryBytes), maxDiaryDuration(maxDiaryDuration), ringPath(move(ringPath)),
+	resources(DiaryResources::GetShared(maxFrameBufferBytes)), frameEncoder(resources->workers, recordNv12, hdrCapture == DiaryHdrCapture::FullPrecision), adaptiveFrameRate(MAX_FRAME_RATE, minFrameRate),
+	frameBufferPool(resources->frameBufferBudget)
+{
+	InitializeCriticalSection(&fileAccessCriticalSection);
 
 	CHECK_HR(CreateDXGIFactory(IID_PPV_ARGS(dxgiFactory.put())));
 
@@ -172,11 +225,15 @@ IAsyncAction DesktopDuplication::Start(HWND hWnd)
 	}
 
 	lastFrameSize = captureItem.Size();
-	framePool = Direct3D11CaptureFramePool::CreateFreeThreaded(d3dRtDevice, DirectXPixelFormat::B8G8R8A8UIntNormalized, 2, lastFrameSize);
+	// half floats keep HDR content as the window rendered it, instead of the system's mapping of it to SDR
+	auto pixelFormat = hdrCapture == DiaryHdrCapture::Off ? DirectXPixelFormat::B8G8R8A8UIntNormalized : DirectXPixelFormat::R16G16B16A16Float;
+	framePool = Direct3D11CaptureFramePool::CreateFreeThreaded(d3dRtDevice, pixelFormat, 2, lastFrameSize);
 	captureSession = framePool.CreateCaptureSession(captureItem);
 	frameArrivedRevoker = framePool.FrameArrived(auto_revoke, { this, &DesktopDuplication::OnFrameArrived });
 
-	OpenNextOutputFile();
+	EnterCriticalSection(&fileAccessCriticalSection);
+	OpenDiaryRing();
+	LeaveCriticalSection(&fileAccessCriticalSection);
 
 	auto res = co_await GraphicsCaptureAccess::RequestAccessAsync(GraphicsCaptureAccessKind::Borderless);
 	if (res == Windows::Security::Authorization::AppCapabilityAccess::AppCapabilityAccessStatus::Allowed)
@@ -185,45 +242,39 @@ IAsyncAction DesktopDuplication::Start(HWND hWnd)
 }
 
 
-void DesktopDuplication::ExportVideo(wstring outputPath, ExportDiaryVideoCompletion completion, void* completionArg)
+void DesktopDuplication::ExportVideo(wstring outputPath, const DiaryExportRange& range, ExportDiaryVideoCompletion completion, void* completionArg)
 {
+	auto getRangeNs = [&](int64_t referenceTimeNs, int64_t& startNs, int64_t& endNs) {
+		auto toNs = [](double seconds) { return chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double>(seconds)).count(); };
+		startNs = range.startSeconds < 0 ? INT64_MIN : referenceTimeNs - toNs(range.startSeconds);
+		endNs = range.endSeconds <= 0 ? INT64_MAX : referenceTimeNs - toNs(range.endSeconds);
+		};
+
+	// recording goes on while exporting, from a snapshot of the blocks in the range recorded so far. Encoding only
+	// waits for the current block to be handed to the ring, the snapshot is copied while frames keep being encoded.
+	// Without a recording, the ring is whatever the last session left behind
+	int64_t startNs{}, endNs{};
+	vector<DiaryReader> diaryReaders;
 	EnterCriticalSection(&fileAccessCriticalSection);
-	// close the current output file, and rename them to temporary names so we can parse them in peace
-	lzmaEncoder.reset();
-
-	int partIdx = 0;
-	vector<filesystem::path> diaryFilePaths;
-	error_code ec;
-	for (int i = outputFileIndex + 1; i < MAX_DIARY_FILES; ++i)
+	auto ring = diaryRing.get();
+	if (ring)
 	{
-		auto srcDiaryFilePath = GetDiaryFilePath(i, false);
-		if (!filesystem::exists(srcDiaryFilePath, ec))
-			continue; // skip if the file doesn't exist
-
-		auto dstDiaryFilePath = srcDiaryFilePath.parent_path() / ("tmp_part_" + to_string(partIdx++));
-		diaryFilePaths.push_back(dstDiaryFilePath);
-		filesystem::remove(dstDiaryFilePath, ec);
-		filesystem::rename(srcDiaryFilePath, dstDiaryFilePath);
+		getRangeNs(chrono::duration_cast<chrono::nanoseconds>(hr_clock::now().time_since_epoch()).count(), startNs, endNs);
+		diaryWriter->Flush();
 	}
-	for (int i = 0; i <= outputFileIndex; ++i)
+	else
 	{
-		auto srcDiaryFilePath = GetDiaryFilePath(i, false);
-		if (!filesystem::exists(srcDiaryFilePath, ec))
-			continue; // skip if the file doesn't exist
-
-		auto dstDiaryFilePath = srcDiaryFilePath.parent_path() / ("tmp_part_" + to_string(partIdx++));
-		diaryFilePaths.push_back(dstDiaryFilePath);
-		filesystem::remove(dstDiaryFilePath, ec);
-		filesystem::rename(srcDiaryFilePath, dstDiaryFilePath);
+		diaryReaders.emplace_back(ringPath);
+		getRangeNs(diaryReaders.back().GetSummary().lastFrameTimeNs, startNs, endNs);
 	}
-
-	OpenNextOutputFile();
-
 	LeaveCriticalSection(&fileAccessCriticalSection);
 
+	if (ring)
+		diaryReaders.emplace_back(make_shared<const vector<BYTE>>(ring->Snapshot(startNs, endNs)));
+
 	// read the max frame size
 	int frameCount{};
-	auto maxFrameSize = GetMaximumSavedFrameSize(diaryFilePaths, frameCount);
+	auto maxFrameSize = GetMaximumSavedFrameSize(diaryReaders, startNs, endNs, frameCount);
 
 	com_ptr<IMFSinkWriter> sinkWriter;
 	DWORD streamIndex{};
@@ -231,71 +282,7 @@ void DesktopDuplication::ExportVideo(wstring outputPath, ExportDiaryVideoComplet
 
 	if (maxFrameSize.Width > 0 && maxFrameSize.Height > 0)
 	{
-		// we must convert RGB32 to NV12
-		com_ptr<IMFTransform> frameTransform;
-		{
-			MFT_REGISTER_TYPE_INFO inputType{}, outputType{};
-			inputType.guidMajorType = MFMediaType_Video;
-			inputType.guidSubtype = MFVideoFormat_RGB32;
-			outputType.guidMajorType = MFMediaType_Video;
-			outputType.guidSubtype = MFVideoFormat_NV12;
-			IMFActivate** mftActivators{};
-			UINT32 mftActivatorsCount{};
-			CHECK_HR(MFTEnumEx(MFT_CATEGORY_VIDEO_PROCESSOR,
-				MFT_ENUM_FLAG_TRANSCODE_ONLY | MFT_ENUM_FLAG_SORTANDFILTER,
-				&inputType, &outputType, &mftActivators, &mftActivatorsCount));
-			CHECK_HR(mftActivators[0]->ActivateObject(IID_PPV_ARGS(frameTransform.put())));
-			CoTaskMemFree(mftActivators);
-		}
-		vector<DWORD> inputStreams, outputStreams;
-		{
-			DWORD inputStreamCount{}, outputStreamCount{};
-			CHECK_HR(frameTransform->GetStreamCount(&inputStreamCount, &outputStreamCount));
-			inputStreams.resize(inputStreamCount);
-			outputStreams.resize(outputStreamCount);
-			auto hr = frameTransform->GetStreamIDs(inputStreamCount, inputStreams.data(), outputStreamCount, outputStreams.data());
-			if (hr == E_NOTIMPL)
-			{
-				// some MFTs don't support GetStreamIDs, so we just assume the first stream is the input and output
-				inputStreams[0] = 0;
-				outputStreams[0] = 0;
-			}
-			else
-				CHECK_HR(hr);
-
-			com_ptr<IMFMediaType> mediaTypeOut, mediaTypeIn;
-			CHECK_HR(MFCreateMediaType(mediaTypeOut.put()));
-			CHECK_HR(mediaTypeOut->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
-			CHECK_HR(mediaTypeOut->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12));
-			CHECK_HR(MFSetAttributeSize(mediaTypeOut.get(), MF_MT_FRAME_SIZE, maxFrameSize.Width, maxFrameSize.Height));
-			CHECK_HR(MFSetAttributeRatio(mediaTypeOut.get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1));
-
-			CHECK_HR(MFCreateMediaType(mediaTypeIn.put()));
-			CHECK_HR(mediaTypeIn->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
-			CHECK_HR(mediaTypeIn->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32));
-			CHECK_HR(MFSetAttributeSize(mediaTypeIn.get(), MF_MT_FRAME_SIZE, maxFrameSize.Width, maxFrameSize.Height));
-			CHECK_HR(MFSetAttributeRatio(mediaTypeIn.get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1));
-
-			frameTransform->SetInputType(inputStreams[0], mediaTypeIn.get(), 0);
-			frameTransform->SetOutputType(outputStreams[0], mediaTypeOut.get(), 0);
-		}
-
-		MFT_OUTPUT_STREAM_INFO outputStreamInfo{};
-		CHECK_HR(frameTransform->GetOutputStreamInfo(outputStreams[0], &outputStreamInfo));
-		if (outputStreamInfo.cbSize == 0)
-			outputStreamInfo.cbSize = maxFrameSize.Width * maxFrameSize.Height * 4;
-
-		com_ptr<IMFMediaBuffer> outputBuffer;
-		CHECK_HR(MFCreateMemoryBuffer(outputStreamInfo.cbSize, outputBuffer.put()));
-
-		com_ptr<IMFSample> outputSample;
-		CHECK_HR(MFCreateSample(outputSample.put()));
-		CHECK_HR(outputSample->AddBuffer(outputBuffer.get()));
-
-		MFT_OUTPUT_DATA_BUFFER mftOutputData{};
-		mftOutputData.dwStreamID = outputStreams[0];
-		mftOutputData.pSample = outputSample.get();
-
+		// the encoder takes NV12, which RGB frames are converted to along the way
 		{
 			com_ptr<IMFMediaType> mediaTypeOut, mediaTypeIn;
 			CHECK_HR(MFCreateMediaType(mediaTypeOut.put()));
@@ -308,6 +295,8 @@ void DesktopDuplication::ExportVideo(wstring outputPath, ExportDiaryVideoComplet
 			CHECK_HR(mediaTypeOut->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
 			CHECK_HR(mediaTypeOut->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE));
 			CHECK_HR(mediaTypeOut->SetUINT32(MF_MT_MPEG2_PROFILE, eAVEncH264VProfile_High));
+			CHECK_HR(mediaTypeOut->SetUINT32(MF_MT_YUV_MATRIX, MFVideoTransferMatrix_BT601));
+			CHECK_HR(mediaTypeOut->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, MFNominalRange_16_235));
 
 			CHECK_HR(MFCreateMediaType(mediaTypeIn.put()));
 			CHECK_HR(mediaTypeIn->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
@@ -315,6 +304,8 @@ void DesktopDuplication::ExportVideo(wstring outputPath, ExportDiaryVideoComplet
 			CHECK_HR(MFSetAttributeSize(mediaTypeIn.get(), MF_MT_FRAME_SIZE, maxFrameSize.Width, maxFrameSize.Height));
 			CHECK_HR(MFSetAttributeRatio(mediaTypeIn.get(), MF_MT_FRAME_RATE, 30, 1)); // 30 FPS
 			CHECK_HR(MFSetAttributeRatio(mediaTypeIn.get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1));
+			CHECK_HR(mediaTypeIn->SetUINT32(MF_MT_YUV_MATRIX, MFVideoTransferMatrix_BT601));
+			CHECK_HR(mediaTypeIn->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, MFNominalRange_16_235));
 
 			com_ptr<IMFAttributes> attributes;
 			CHECK_HR(MFCreateAttributes(attributes.put(), 1));
@@ -327,77 +318,156 @@ void DesktopDuplication::ExportVideo(wstring outputPath, ExportDiaryVideoComplet
 			CHECK_HR(sinkWriter->BeginWriting());
 		}
 
-		int64_t frameTimePointNs{};
-		int frameIndex{};
-		for (auto& diaryFilePath : diaryFilePaths)
+		// decoding, conversion and encoding each run on their own thread, only waiting on each other through
+		// the bounded queues in between. An empty frame or sample ends the stream
+		moodycamel::BlockingReaderWriterCircularBuffer<DiaryFrame> decodedFrames{ EXPORT_PIPELINE_DEPTH };
+		moodycamel::BlockingReaderWriterCircularBuffer<com_ptr<IMFSample>> samples{ EXPORT_PIPELINE_DEPTH };
+		atomic<bool> cancelled{};
+		atomic<int> skippedFrames{};
+
+		// enough for every frame in flight: the queued ones, plus the one being converted and the one being copied. The
+		// frame held back until the next different one is queued before its replacement is rented
+		size_t maxFrameBytes{};
+		for (auto& diaryReader : diaryReaders)
 		{
+			auto [firstBlock, endBlock] = diaryReader.FindBlocks(startNs, endNs);
+			for (auto blockIndex = firstBlock; blockIndex < endBlock; ++blockIndex)
 			{
-				LzmaDecoder decoder(make_unique<ifstream>(diaryFilePath, ios::binary | ios::in), errorFunc);
-
-				while (true)
+				auto& header = diaryReader.GetBlocks()[blockIndex].header;
+				auto layout = GetDiaryPlaneLayout(static_cast<DXGI_FORMAT>(header.format), header.width, header.height);
+				maxFrameBytes = max(maxFrameBytes, static_cast<size_t>(layout.width) * layout.height * layout.bytesPerPixel);
+			}
+		}
+		MemoryBudget frameBuffersBudget((EXPORT_PIPELINE_DEPTH + 2) * maxFrameBytes);
+		FrameBufferPool frameBuffers(frameBuffersBudget);
+
+		auto decodeHr = S_OK;
+		thread decodeThread([&] {
+			// a frame is held back until the next different one, the identical frames in between aren't converted or
+			// encoded again but make it last longer, and its interval becomes the time it stays on screen
+			DiaryFrame heldFrame;
+			int64_t heldEndNs{};
+			auto releaseHeldFrame = [&](int64_t endNs) {
+				if (heldFrame.data.empty())
+					return;
+				heldFrame.frameIntervalNs = endNs - heldFrame.timeNs;
+				decodedFrames.wait_enqueue(move(heldFrame));
+				heldFrame = {};
+				};
+
+			auto enqueueFrame = [&](const DiaryFrame& frame, int64_t timeNs, bool repeat) {
+				// repeats are recorded as such, key frames are compared since they're recorded whether anything changed or not
+				if (!heldFrame.data.empty() && (repeat || (frame.type == DiaryFrameType::Key && frame.width == heldFrame.width
+					&& frame.height == heldFrame.height && frame.format == heldFrame.format && frame.bottomUp == heldFrame.bottomUp
+					&& equal(frame.data.begin(), frame.data.end(), heldFrame.data.begin()))))
 				{
-					int width{}, height{};
-					DXGI_FORMAT format{};
-					hr_time_point::rep frameTimeNs{};
-					decoder.Decode(width);
-					if (decoder.IsEof())
-						break; // end of file
-					decoder.Decode(height);
-					if (decoder.IsEof())
-						break; // end of file
-					decoder.Decode(format);
-					if (decoder.IsEof())
-						break; // end of file
-					decoder.Decode(frameTimeNs);
-					if (decoder.IsEof())
-						break; // end of file
-
-					// advance the time
-					frameTimePointNs += frameTimeNs;
-					auto bpp = GetFormatBytesPerPixel(format);
+					heldEndNs = timeNs + frame.frameIntervalNs;
+					++skippedFrames;
+					return;
+				}
+
+				// the held frame goes first, waiting for a buffer while holding one back could otherwise wait on itself
+				releaseHeldFrame(timeNs);
 
+				// the reader reuses its frame, so it's copied into a recycled buffer once the later stages free one up
+				auto data = frameBuffers.Rent(frame.data.size(), cancelled);
+				if (data.empty())
+				{
+					// the budget fits the largest frame in the range several times over, this is only ever a frame larger than that
+					if (!cancelled)
 					{
-						// MFT transform
-						com_ptr<IMFSample> sample;
-						CHECK_HR(MFCreateSample(sample.put()));
-						CHECK_HR(sample->SetSampleTime(frameTimePointNs / 100));
-
-						com_ptr<IMFMediaBuffer> mediaBuffer;
-						CHECK_HR(MFCreateAlignedMemoryBuffer(maxFrameSize.Width * maxFrameSize.Height * bpp, sizeof(void*), mediaBuffer.put()));
-
-						BYTE* data = nullptr;
-						CHECK_HR(mediaBuffer->Lock(&data, nullptr, nullptr));
-
-						auto rowPadding = maxFrameSize.Width - width;
-						auto yOffset = (maxFrameSize.Height - height) * maxFrameSize.Width * bpp;
-						if (!rowPadding)
-							decoder.Decode({ data + yOffset, static_cast<size_t>(width * height * bpp) });
-						else
-							for (int y = 0; y < height; ++y)
-							{
-								decoder.Decode({ data + y * maxFrameSize.Width * bpp + yOffset, static_cast<size_t>(width * bpp) });
-								memset(data + y * maxFrameSize.Width * bpp + yOffset + width * bpp, 0, rowPadding * bpp);
-							}
-
-						CHECK_HR(mediaBuffer->Unlock());
-						CHECK_HR(mediaBuffer->SetCurrentLength(width * height * bpp));
-
-						CHECK_HR(sample->AddBuffer(mediaBuffer.get()));
-						CHECK_HR(frameTransform->ProcessInput(inputStreams[0], sample.get(), 0));
-
-						completion(++frameIndex / (float)frameCount, completionArg);
+						decodeHr = E_OUTOFMEMORY;
+						cancelled = true;
 					}
+					return;
+				}
+				copy(frame.data.begin(), frame.data.end(), data.begin());
+				heldFrame = DiaryFrame{ frame.width, frame.height, frame.format, frame.bottomUp, timeNs, frame.type, 0, move(data) };
+				heldEndNs = timeNs + frame.frameIntervalNs;
+				};
+
+			// the first block starts at or before the range, and the frame on screen when the range starts is held
+			// back until it's known to be the last one before it, then shown from the start of the range
+			DiaryFrame frameBeforeRange;
+			for (auto& diaryReader : diaryReaders)
+			{
+				auto [firstBlock, endBlock] = diaryReader.FindBlocks(startNs, endNs);
+				for (auto blockIndex = firstBlock; blockIndex < endBlock && !cancelled; ++blockIndex)
+				{
+					DiaryBlockReader blockReader(diaryReader, blockIndex, errorFunc, &resources->workers);
+					while (!cancelled && blockReader.ReadFrame())
+					{
+						auto& frame = blockReader.GetFrame();
+						if (frame.timeNs > endNs)
+							break;
+						if (frame.timeNs < startNs)
+						{
+							frameBeforeRange.width = frame.width;
+							frameBeforeRange.height = frame.height;
+							frameBeforeRange.format = frame.format;
+							frameBeforeRange.bottomUp = frame.bottomUp;
+							frameBeforeRange.frameIntervalNs = frame.frameIntervalNs;
+							frameBeforeRange.data.assign(frame.data.begin(), frame.data.end());
+							continue;
+						}
+
+						if (!frameBeforeRange.data.empty() && frame.timeNs > startNs)
+							enqueueFrame(frameBeforeRange, startNs, false);
+						frameBeforeRange.data.clear();
+						enqueueFrame(frame, frame.timeNs, frame.type == DiaryFrameType::Repeat);
+					}
+				}
+			}
+			if (!frameBeforeRange.data.empty() && !cancelled)
+				enqueueFrame(frameBeforeRange, startNs, false);
+			releaseHeldFrame(heldEndNs);
+			decodedFrames.wait_enqueue(DiaryFrame{});
+			});
+
+		// the encode stage's buffers are the largest, they're recycled as well
+		auto samplePool = make_self<Nv12SamplePool>(static_cast<DWORD>(maxFrameSize.Width * maxFrameSize.Height * 3 / 2));
+
+		auto convertHr = S_OK;
+		thread convertThread([&] {
+			optional<int64_t> firstFrameTimeNs;
+			vector<BYTE> conversionBuffer;
+			DiaryFrame frame;
+			for (decodedFrames.wait_dequeue(frame); !frame.data.empty(); decodedFrames.wait_dequeue(frame))
+			{
+				// the video starts at the first recorded frame
+				if (!firstFrameTimeNs)
+					firstFrameTimeNs = frame.timeNs;
 
-					// samples
-					CHECK_HR(WriteTransformOutputSamplesToSink(frameTransform, sinkWriter, mftOutputData));
+				com_ptr<IMFSample> sample;
+				if (!cancelled)
+				{
+					if (SUCCEEDED(convertHr = CreateNv12Sample(frame, maxFrameSize, frame.timeNs - *firstFrameTimeNs, conversionBuffer, *samplePool, sample)))
+						samples.wait_enqueue(move(sample));
+					else
+						cancelled = true;
 				}
+				frameBuffers.Return(move(frame.data));
 			}
-			filesystem::remove(diaryFilePath, ec);
+			samples.wait_enqueue(nullptr);
+			});
+
+		// on failure the earlier stages stop and the queues are drained, so the threads can always be joined
+		auto writeHr = S_OK;
+		int frameIndex{};
+		com_ptr<IMFSample> sample;
+		for (samples.wait_dequeue(sample); sample; samples.wait_dequeue(sample))
+		{
+			if (SUCCEEDED(writeHr) && FAILED(writeHr = sinkWriter->WriteSample(streamIndex, sample.get())))
+				cancelled = true;
+			completion((++frameIndex + skippedFrames) / (float)frameCount, completionArg);
 		}
+		decodeThread.join();
+		convertThread.join();
+		samplePool->Close();
 
-		// drain the MFT
-		frameTransform->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, 0);
-		CHECK_HR(WriteTransformOutputSamplesToSink(frameTransform, sinkWriter, mftOutputData));
+		CHECK_HR(decodeHr);
+		CHECK_HR(convertHr);
+		CHECK_HR(writeHr);
 	}
 
 	sinkWriter->Finalize();
@@ -407,23 +477,31 @@ void DesktopDuplication::ExportVideo(wstring outputPath, ExportDiaryVideoComplet
 
 void DesktopDuplication::StopDiaryAndWait()
 {
-	stopping = true;
-
-	captureSession.Close();
-	frameProcessingThread.join();
-	lzmaEncoder.reset();
+	{
+		lock_guard lock(processingMutex);
+		stopping = true;
+	}
 
-	for (int diaryIdx = 0;; ++diaryIdx)
+	// the frames still queued are dropped, the one being encoded is finished
+	if (captureSession)
+		captureSession.Close();
 	{
-		auto diaryFilePath = GetDiaryFilePath(diaryIdx, false);
-		if (!filesystem::exists(diaryFilePath))
-			break; // no more diary files
+		unique_lock lock(processingMutex);
+		processingIdle.wait(lock, [&] { return !processingScheduled; });
+	}
+	diaryWriter.reset();
+	diaryRing.reset();
 
-		error_code ec;
-		while (!filesystem::remove(diaryFilePath, ec))
+	// an export of the ring can still have it open for a while, past that the ring is left for the next session
+	error_code ec;
+	for (int attempt = 1; filesystem::exists(ringPath, ec) && !filesystem::remove(ringPath, ec); ++attempt)
+	{
+		if (attempt == RING_DELETE_ATTEMPTS)
 		{
-			// keep retrying to delete these files until the capture is done with them
+			errorFunc(HRESULT_FROM_WIN32(ec.value()));
+			break;
 		}
+		this_thread::sleep_for(RING_DELETE_RETRY_DELAY);
 	}
 }
 
@@ -443,6 +521,16 @@ void DesktopDuplication::OnFrameArrived(Direct3D11CaptureFramePool const& sender
 	if (stopping) return;
 
 	auto newFrame = sender.TryGetNextFrame();
+	PipelineStatistics::Add(statistics.framesCaptured);
+
+	// frame rate limiter, before anything gets copied
+	auto now = hr_clock::now();
+	if (!frameRateLimiter.TryAdmit(duration_cast<chrono::nanoseconds>(now.time_since_epoch()).count()))
+	{
+		PipelineStatistics::Add(statistics.framesRateLimited);
+		return;
+	}
+
 	auto newFrameSize = newFrame.ContentSize();
 
 	auto newFrameSurface = newFrame.Surface();
@@ -473,8 +561,9 @@ void DesktopDuplication::OnFrameArrived(Direct3D11CaptureFramePool const& sender
 	// try to map for reading
 	D3D11_MAPPED_SUBRESOURCE mappedResource{};
 	CHECK_HR(immediateContext->Map(stagingTexture.get(), 0, D3D11_MAP_READ, 0, &mappedResource));
-	WriteRecordedImageToCircularFrameBuffer(mappedResource, desc.Format, newFrameSize);
+	WriteRecordedImageToCircularFrameBuffer(mappedResource, desc.Format, newFrameSize, now);
 	immediateContext->Unmap(stagingTexture.get(), 0);
+	statistics.copyLatency.Record(hr_clock::now() - now);
 
 	// resize the frame pool if the size has changed
 	if (newFrameSize != lastFrameSize)
@@ -484,104 +573,264 @@ void DesktopDuplication::OnFrameArrived(Direct3D11CaptureFramePool const& sender
 	}
 }
 
-std::filesystem::path DesktopDuplication::GetDiaryFilePath(int index, bool create)
+std::filesystem::path DesktopDuplication::GetDiaryRingPath(LPCWSTR name)
 {
-	filesystem::path diaryPath = filesystem::current_path() / ".diary";
+	return filesystem::current_path() / ".diary" / (name && *name ? wstring(name) + L".ring" : L"diary.ring");
+}
 
-	if (create)
-		filesystem::create_directory(diaryPath);
+bool DesktopDuplication::HasLeftOverDiary() const
+{
+	// a ring with blocks in it means the last session crashed. Only its header is read, the blocks are checked when
+	// it's exported
+	return DiaryReader::ReadRingHeader(ringPath).blockCount > 0;
+}
+
+void DesktopDuplication::ScheduleFrameProcessing()
+{
+	{
+		lock_guard lock(processingMutex);
+		if (processingScheduled || stopping)
+			return;
+		processingScheduled = true;
+	}
 
-	return diaryPath / ("diary_" + to_string(index) + ".dat");
+	resources->workers.Submit([this] { ProcessFrames(); });
+}
+
+void DesktopDuplication::ProcessFrames()
+{
+	// a few frames at a time, the other diaries' frames get their turn in between
+	FrameData frameData;
+	for (size_t frame = 0; frame < FRAME_PROCESSING_BATCH && !stopping && frames.try_dequeue(frameData); ++frame)
+		EncodeFrame(frameData);
+
+	// the frames left go to the back of the line, StopDiaryAndWait waits for the processing to be idle
+	bool reschedule;
+	{
+		lock_guard lock(processingMutex);
+		processingScheduled = reschedule = !stopping && frames.size_approx();
+		if (!reschedule)
+			processingIdle.notify_all();
+	}
+	if (reschedule)
+		resources->workers.Submit([this] { ProcessFrames(); });
 }
 
-void DesktopDuplication::OpenNextOutputFile()
+void DesktopDuplication::EncodeFrame(FrameData& frameData)
 {
-	outputFileIndex = (outputFileIndex + 1) % MAX_DIARY_FILES;
+	EnterCriticalSection(&fileAccessCriticalSection);
+
+	auto encodeStart = hr_clock::now();
+	auto timeNs = duration_cast<chrono::nanoseconds>(frameData.now.time_since_epoch()).count();
+	diaryWriter->SetFrameInterval(frameData.frameIntervalNs);
+	frameEncoder.Encode(*diaryWriter, frameData.data.data(), frameData.width, frameData.height, frameData.stride,
+		frameData.format, timeNs);
+	auto encodeTime = hr_clock::now() - encodeStart;
+	statistics.encodeLatency.Record(encodeTime);
+	PipelineStatistics::Add(statistics.framesEncoded);
 
-	lzmaEncoder = make_unique<LzmaEncoder>(
-		make_unique<ofstream>(GetDiaryFilePath(outputFileIndex, true), ios::binary | ios::out | ios::trunc),
-		errorFunc);
+	// the next frames are admitted at a rate that follows the content, and that the encoder can keep up with
+	frameRateLimiter.SetFrameRate(adaptiveFrameRate.Update(timeNs, frameEncoder.GetChangedTileShare(), encodeTime,
+		frames.size_approx(), FRAME_QUEUE_CAPACITY));
+
+	LeaveCriticalSection(&fileAccessCriticalSection);
+
+	frameBufferPool.Return(move(frameData.data));
 }
 
-void DesktopDuplication::WriteRecordedImageToCircularFrameBuffer(const D3D11_MAPPED_SUBRESOURCE& mappedResource, DXGI_FORMAT format, SizeInt32 newFrameSize)
+void DesktopDuplication::OpenDiaryRing()
 {
-	auto bytesPerPixel = GetFormatBytesPerPixel(format);
-	assert(bytesPerPixel == 4);
+	// preallocated once, blocks are written in place from then on
+	error_code ec;
+	filesystem::create_directory(ringPath.parent_path(), ec);
+	diaryRing = make_unique<DiaryRing>(ringPath, maxDiaryBytes, maxDiaryDuration, errorFunc);
+	diaryWriter = make_unique<DiaryWriter>(*diaryRing, resources->workers, errorFunc, codec, &statistics);
+}
+
+void DesktopDuplication::WriteRecordedImageToCircularFrameBuffer(const D3D11_MAPPED_SUBRESOURCE& mappedResource, DXGI_FORMAT format, SizeInt32 newFrameSize, hr_time_point now)
+{
+	// formats the diary can't record are reported, and the frame is skipped
+	if (!GetFormatBytesPerPixel(format))
+		return;
 
 	// don't know why the size doesn't match the buffer
 	if (mappedResource.RowPitch * newFrameSize.Height > mappedResource.DepthPitch)
 		return;
 
-	vector<BYTE> frameBytes(mappedResource.RowPitch * newFrameSize.Height);
+	auto frameBytes = frameBufferPool.Rent(mappedResource.RowPitch * newFrameSize.Height);
+	if (frameBytes.empty())
+	{
+		// too many frames in flight
+		PipelineStatistics::Add(statistics.framesDroppedNoBuffer);
+		return;
+	}
 	copy(reinterpret_cast<const BYTE*>(mappedResource.pData),
 		reinterpret_cast<const BYTE*>(mappedResource.pData) + mappedResource.RowPitch * newFrameSize.Height,
 		frameBytes.begin());
 
-	frames.try_enqueue({ newFrameSize.Width, newFrameSize.Height, (int)mappedResource.RowPitch,
-		format, hr_clock::now(), move(frameBytes) });
-	SetEvent(newFrameReadyEvent.get()); // signal that a new frame is ready
+	FrameData frameData{ newFrameSize.Width, newFrameSize.Height, (int)mappedResource.RowPitch,
+		format, now, frameRateLimiter.GetFrameIntervalNs(), move(frameBytes) };
+	if (!frames.try_enqueue(move(frameData)))
+	{
+		// the queue is full, the frame is dropped
+		frameBufferPool.Return(move(frameData.data));
+		PipelineStatistics::Add(statistics.framesDropped);
+	}
+	ScheduleFrameProcessing();
+}
+
+void DesktopDuplication::SetFrameRate(double frameRate)
+{
+	adaptiveFrameRate.SetMaxFrameRate(frameRate);
+	frameRateLimiter.SetFrameRate(frameRate);
+}
+
+void DesktopDuplication::GetStatistics(DiaryStatistics& result) const
+{
+	statistics.Snapshot(result);
+	result.queueDepth = frames.size_approx();
+	result.frameBufferPoolBytes = frameBufferPool.GetTotalBytes();
 }
 
-Windows::Graphics::SizeInt32 DesktopDuplication::GetMaximumSavedFrameSize(const vector<filesystem::path>& partPaths, int& frameCount) const
+Windows::Graphics::SizeInt32 DesktopDuplication::GetMaximumSavedFrameSize(const vector<DiaryReader>& diaryReaders, int64_t startNs, int64_t endNs,
+	int& frameCount) const
 {
 	SizeInt32 maxSize{};
 	frameCount = 0;
 
-	for (const auto& partPath : partPaths)
+	// only the index is read, the frame count is that of the whole blocks so it can overshoot the range a little
+	for (const auto& diaryReader : diaryReaders)
 	{
-		LzmaDecoder decoder(make_unique<ifstream>(partPath, ios::binary | ios::in), errorFunc);
-
-		while (true)
+		auto [firstBlock, endBlock] = diaryReader.FindBlocks(startNs, endNs);
+		for (auto blockIndex = firstBlock; blockIndex < endBlock; ++blockIndex)
 		{
-			SizeInt32 size{};
-			decoder.Decode(size.Width);
-			if (decoder.IsEof())
-				break;
-			decoder.Decode(size.Height);
-			if (decoder.IsEof())
-				break;
-			DXGI_FORMAT format{};
-			decoder.Decode(format);
-			if (decoder.IsEof())
-				break;
-			decoder.Skip(sizeof(chrono::nanoseconds::rep)); // skip timestamp
-			decoder.Skip(size.Width * size.Height * GetFormatBytesPerPixel(format)); // skip pixel data
-
-			maxSize.Width = max(maxSize.Width, size.Width);
-			maxSize.Height = max(maxSize.Height, size.Height);
-			++frameCount;
+			// the video is NV12, RGB frames are padded to an even size when they're converted
+			auto& header = diaryReader.GetBlocks()[blockIndex].header;
+			maxSize.Width = max(maxSize.Width, roundUp(header.width, 2));
+			maxSize.Height = max(maxSize.Height, roundUp(header.height, 2));
+			frameCount += header.frameCount;
 		}
 	}
 
 	return maxSize;
 }
 
-HRESULT DesktopDuplication::WriteTransformOutputSamplesToSink(com_ptr<IMFTransform>& frameTransform,
-	com_ptr<IMFSinkWriter>& sinkWriter, MFT_OUTPUT_DATA_BUFFER& mftOutputData) const
+void DesktopDuplication::CopyFrameToNv12(const DiaryFrame& frame, BYTE* nv12, SizeInt32 nv12Size, vector<BYTE>& conversionBuffer) const
 {
-nextSample:
-	DWORD outputStatus = 0;
-	auto outputHr = frameTransform->ProcessOutput(0, 1, &mftOutputData, &outputStatus);
-	if (outputHr == S_OK)
+	auto width = frame.width, height = frame.height;
+	auto frameData = frame.data.data();
+	if (frame.format != DXGI_FORMAT_NV12)
 	{
-		CHECK_HR_RET(sinkWriter->WriteSample(mftOutputData.dwStreamID, mftOutputData.pSample));
-		goto nextSample;
+		// the conversion flips bottom-up frames as it goes, and pads odd sizes by repeating the last row and column
+		auto rowSize = static_cast<ptrdiff_t>(width) * GetFormatBytesPerPixel(frame.format);
+		auto firstRow = frame.bottomUp ? frameData + (height - 1) * rowSize : frameData;
+		auto stride = frame.bottomUp ? -rowSize : rowSize;
+		width = roundUp(width, 2);
+		height = roundUp(height, 2);
+		auto nv12Bytes = static_cast<size_t>(width) * height * 3 / 2;
+		if (frame.format == DXGI_FORMAT_R16G16B16A16_FLOAT)
+		{
+			// frames recorded at full precision are tone mapped to top-down BGRA first, after the NV12 frame
+			conversionBuffer.resize(nv12Bytes + static_cast<size_t>(frame.width) * frame.height * 4);
+			ToneMapHalfToBgra(firstRow, stride, frame.width, conversionBuffer.data() + nv12Bytes, 0, frame.height);
+			firstRow = conversionBuffer.data() + nv12Bytes;
+			stride = static_cast<ptrdiff_t>(frame.width) * 4;
+		}
+		else
+			conversionBuffer.resize(nv12Bytes);
+		ConvertBgraToNv12(firstRow, stride, frame.width, frame.height,
+			conversionBuffer.data(), width, height, 0, height);
+		frameData = conversionBuffer.data();
 	}
-	else if (outputHr == MF_E_TRANSFORM_NEED_MORE_INPUT)
-		return S_OK;
-	else if (FAILED(outputHr))
-		CHECK_HR_RET(outputHr);
 
-	return E_NOTIMPL;
+	// the frame goes in the top left corner, the rest is black
+	auto copyPlane = [&](const BYTE* source, BYTE* destination, int rows, BYTE padding) {
+		for (int y = 0; y < rows; ++y)
+		{
+			memcpy(destination + y * nv12Size.Width, source + y * width, width);
+			memset(destination + y * nv12Size.Width + width, padding, nv12Size.Width - width);
+		}
+		};
+	auto uvPlane = nv12 + nv12Size.Width * nv12Size.Height;
+	copyPlane(frameData, nv12, height, 16);
+	memset(nv12 + height * nv12Size.Width, 16, (nv12Size.Height - height) * nv12Size.Width);
+	copyPlane(frameData + width * height, uvPlane, height / 2, 128);
+	memset(uvPlane + height / 2 * nv12Size.Width, 128, (nv12Size.Height - height) / 2 * nv12Size.Width);
 }
 
-int DesktopDuplication::GetFormatBytesPerPixel(DXGI_FORMAT format) const
+HRESULT DesktopDuplication::CreateNv12Sample(const DiaryFrame& frame, SizeInt32 nv12Size, int64_t timeNs,
+	vector<BYTE>& conversionBuffer, Nv12SamplePool& samplePool, com_ptr<IMFSample>& sample) const
+{
+	CHECK_HR_RET(samplePool.Rent(sample));
+	CHECK_HR_RET(sample->SetSampleTime(timeNs / 100));
+	// lasts the interval frames were being recorded at, which the adaptive frame rate varies. Every frame has one
+	// once it leaves the decode stage, so a recycled sample never keeps its previous duration
+	CHECK_HR_RET(sample->SetSampleDuration(frame.frameIntervalNs / 100));
+
+	com_ptr<IMFMediaBuffer> mediaBuffer;
+	CHECK_HR_RET(sample->GetBufferByIndex(0, mediaBuffer.put()));
+
+	BYTE* data = nullptr;
+	CHECK_HR_RET(mediaBuffer->Lock(&data, nullptr, nullptr));
+	CopyFrameToNv12(frame, data, nv12Size, conversionBuffer);
+	return mediaBuffer->Unlock();
+}
+
+HRESULT Nv12SamplePool::Rent(com_ptr<IMFSample>& sample)
 {
-	switch (format)
 	{
-	case DXGI_FORMAT_R8G8B8A8_UNORM: return 4;
-	case DXGI_FORMAT_B8G8R8A8_UNORM: return 4;
-	case DXGI_FORMAT_R16G16B16A16_FLOAT: return 8;
-	default: errorFunc(E_NOTIMPL);
+		lock_guard lock(freeSamplesMutex);
+		if (!freeSamples.empty())
+		{
+			sample = move(freeSamples.back());
+			freeSamples.pop_back();
+		}
+	}
+
+	com_ptr<IMFTrackedSample> trackedSample;
+	if (sample)
+		trackedSample = sample.as<IMFTrackedSample>();
+	else
+	{
+		// only allocated while the ones in flight aren't enough
+		com_ptr<IMFMediaBuffer> mediaBuffer;
+		HRESULT hr;
+		if (FAILED(hr = MFCreateTrackedSample(trackedSample.put()))
+			|| FAILED(hr = MFCreateAlignedMemoryBuffer(bufferSize, sizeof(void*), mediaBuffer.put()))
+			|| FAILED(hr = mediaBuffer->SetCurrentLength(bufferSize))
+			|| FAILED(hr = trackedSample.as<IMFSample>()->AddBuffer(mediaBuffer.get())))
+			return hr;
+		sample = trackedSample.as<IMFSample>();
 	}
+
+	// the sample is only tracked until it comes back, and has to be tracked again every time it's handed out
+	return trackedSample->SetAllocator(this, nullptr);
+}
+
+void Nv12SamplePool::Close()
+{
+	lock_guard lock(freeSamplesMutex);
+	closed = true;
+	freeSamples.clear();
+}
+
+HRESULT Nv12SamplePool::Invoke(IMFAsyncResult* result) noexcept
+{
+	// the released sample is the result's object
+	com_ptr<::IUnknown> object;
+	if (FAILED(result->GetObject(object.put())))
+		return S_OK;
+
+	lock_guard lock(freeSamplesMutex);
+	if (auto sample = object.try_as<IMFSample>(); sample && !closed)
+		freeSamples.push_back(move(sample));
+	return S_OK;
+}
+
+int DesktopDuplication::GetFormatBytesPerPixel(DXGI_FORMAT format) const
+{
+	auto bytesPerPixel = GetDiaryFormatBytesPerPixel(format);
+	if (!bytesPerPixel)
+		errorFunc(E_NOTIMPL);
+	return bytesPerPixel;
 }
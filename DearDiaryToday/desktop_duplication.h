@@ -1,52 +1,166 @@
 #pragma once
 
-#include "LzmaEncoder.h"
+#include "FrameEncoder.h"
+#include "FrameBufferPool.h"
+#include "FrameRateLimiter.h"
+#include "AdaptiveFrameRate.h"
+#include "PipelineStatistics.h"
+#include "DiaryReader.h"
 
 extern "C" {
-	bool __declspec(dllexport) __stdcall InitializeDiary(ErrorFunc);
+	struct DiaryOptions
+	{
+		DiaryCodec codec;
+		int32_t codecLevel;		// 0 picks the codec's default
+		int32_t recordNv12;		// records YUV 4:2:0 instead of BGRA, 2.7x less data to hash, diff and compress
+		uint64_t maxDiaryBytes;	// size of the diary ring on disk, 0 for DEFAULT_DIARY_RING_BYTES
+		double maxDiarySeconds;	// how far back the diary goes if it fits in maxDiaryBytes, 0 for DEFAULT_DIARY_DURATION, < 0 for no limit
+		double minFrameRate;	// the frame rate idle windows decay to, 0 for DEFAULT_MIN_FRAME_RATE, < 0 to always record at the maximum
+		DiaryHdrCapture hdrCapture;
+		uint64_t maxFrameBufferBytes;	// cap on the frames waiting to be encoded, for all the diaries together and set by the first one opened, 0 for MAX_FRAME_BUFFER_POOL_BYTES
+	};
+
+	// the options can be null for the defaults. These functions work on a single diary, the Diary* ones below on
+	// any number of them
+	bool __declspec(dllexport) __stdcall InitializeDiary(ErrorFunc, const DiaryOptions*);
 
 	void __declspec(dllexport) __stdcall StartDiary(HWND);
 
+	// in seconds before the export, or before the last recorded frame for a diary left over by a crash
+	struct DiaryExportRange
+	{
+		double startSeconds;	// < 0 for the start of the diary
+		double endSeconds;		// 0 for the end of the diary
+	};
+
 	typedef void (*ExportDiaryVideoCompletion)(float, void*);
 	void __declspec(dllexport) __stdcall  ExportDiaryVideo(LPWSTR, ExportDiaryVideoCompletion, void*);
+	void __declspec(dllexport) __stdcall  ExportDiaryVideoRange(LPWSTR, const DiaryExportRange*, ExportDiaryVideoCompletion, void*);
 
 	typedef void (*StopDiaryCompletion)(void*);
 	void __declspec(dllexport) __stdcall StopDiary(StopDiaryCompletion, void*);
+
+	void __declspec(dllexport) __stdcall SetDiaryFrameRate(double);
+
+	void __declspec(dllexport) __stdcall GetDiaryStatistics(DiaryStatistics*);
+
+	// a diary recording a single window, any number of them can record at once. They share the compression threads
+	// and the memory budget of the frames in flight
+	typedef struct DiaryInstance* DiaryHandle;
+
+	// the name picks the diary's file, it must be unique among the diaries recording at once, null for the diary of
+	// InitializeDiary. Returns true if the diary was left over by a crash, it can be exported before it's started
+	bool __declspec(dllexport) __stdcall OpenDiary(LPCWSTR name, ErrorFunc, const DiaryOptions*, DiaryHandle*);
+	void __declspec(dllexport) __stdcall DiaryStart(DiaryHandle, HWND);
+	void __declspec(dllexport) __stdcall DiaryExportVideo(DiaryHandle, LPWSTR, const DiaryExportRange*, ExportDiaryVideoCompletion, void*);
+	// closes the handle once the diary stopped, which can be without ever starting it
+	void __declspec(dllexport) __stdcall DiaryStop(DiaryHandle, StopDiaryCompletion, void*);
+	void __declspec(dllexport) __stdcall DiarySetFrameRate(DiaryHandle, double);
+	void __declspec(dllexport) __stdcall DiaryGetStatistics(DiaryHandle, DiaryStatistics*);
 }
 
-constexpr int MAX_DIARY_FILES = 2;
 constexpr int MAX_FRAME_RATE = 30;
-constexpr int MAX_FRAMES_PER_DIARY_FILE = 10 * MAX_FRAME_RATE;
+constexpr size_t FRAME_QUEUE_CAPACITY = 10;
+constexpr size_t FRAME_PROCESSING_BATCH = 4;		// frames encoded in a row before the threads move on to another diary's
+constexpr uint64_t DEFAULT_DIARY_RING_BYTES = 128 * 1024 * 1024;
+constexpr auto DEFAULT_DIARY_DURATION = std::chrono::seconds(20);
+constexpr int RING_DELETE_ATTEMPTS = 50;		// when stopping, before giving up on deleting the ring
+constexpr auto RING_DELETE_RETRY_DELAY = std::chrono::milliseconds(100);
+
+constexpr size_t MAX_FRAME_BUFFER_POOL_BYTES = 256 * 1024 * 1024;		// the default, for all the diaries together
 
 constexpr int DIARY_VIDEO_BITRATE = 5000 * 1024;
+constexpr size_t EXPORT_PIPELINE_DEPTH = 4;		// frames queued between each of the export stages
+
+// what all the diaries share: a single set of threads for encoding and exporting, and a single budget for the frames
+// waiting to be encoded
+struct DiaryResources final
+{
+	// counting the caller, so there is at least one thread of its own even on a single core and frames are never
+	// encoded on the capture thread
+	WorkerPool workers{ (std::max)(2u, std::thread::hardware_concurrency()) };
+	MemoryBudget frameBufferBudget;
+
+	DiaryResources(size_t maxFrameBufferBytes) : frameBufferBudget(maxFrameBufferBytes) {}
+
+	// created with the first diary and released with the last one, the budget is the first diary's
+	static std::shared_ptr<DiaryResources> GetShared(size_t maxFrameBufferBytes);
+};
+
+// recycles the NV12 samples of an export, which come back once the sink writer and the encoder release them. Grows to
+// however many they keep in flight, the encoder can hold on to a few frames until the next ones arrive
+struct Nv12SamplePool : winrt::implements<Nv12SamplePool, IMFAsyncCallback>
+{
+	Nv12SamplePool(DWORD bufferSize) : bufferSize(bufferSize) {}
+
+	// a sample with a single buffer of the pool's size
+	HRESULT Rent(winrt::com_ptr<IMFSample>&);
+	// the samples still in flight are dropped once they're released, rather than keeping the pool alive
+	void Close();
+
+	HRESULT __stdcall GetParameters(DWORD*, DWORD*) noexcept override { return E_NOTIMPL; }
+	HRESULT __stdcall Invoke(IMFAsyncResult*) noexcept override;
+
+private:
+	const DWORD bufferSize;
+	std::mutex freeSamplesMutex;
+	std::vector<winrt::com_ptr<IMFSample>> freeSamples;
+	bool closed{};
+};
 
 struct DesktopDuplication : winrt::implements<DesktopDuplication, ::IInspectable>
 {
-	DesktopDuplication(ErrorFunc);
+	DesktopDuplication(ErrorFunc, std::filesystem::path ringPath, StreamCodec = {}, bool recordNv12 = false,
+		DiaryHdrCapture = DiaryHdrCapture::Off, uint64_t maxDiaryBytes = DEFAULT_DIARY_RING_BYTES,
+		std::chrono::nanoseconds maxDiaryDuration = DEFAULT_DIARY_DURATION, double minFrameRate = DEFAULT_MIN_FRAME_RATE,
+		size_t maxFrameBufferBytes = MAX_FRAME_BUFFER_POOL_BYTES);
 	winrt::Windows::Foundation::IAsyncAction Start(HWND);
-	void ExportVideo(std::wstring, ExportDiaryVideoCompletion, void*);
+	void ExportVideo(std::wstring, const DiaryExportRange&, ExportDiaryVideoCompletion, void*);
 	void StopDiaryAndWait();
+	// the maximum, the frame rate adapts to the content and the encoder's load below it
+	void SetFrameRate(double frameRate);
+	void GetStatistics(DiaryStatistics&) const;
+
+	// true if the ring was left over by a crash
+	bool HasLeftOverDiary() const;
 
-	static std::filesystem::path GetDiaryFilePath(int index, bool create);
+	// the ring of the named diary, the default one without a name
+	static std::filesystem::path GetDiaryRingPath(LPCWSTR name);
+	const std::filesystem::path& GetRingPath() const { return ringPath; }
 
 private:
 	volatile bool stopping{};
 	const ErrorFunc errorFunc;
-	int outputFileIndex = -1;
-	std::unique_ptr<LzmaEncoder> lzmaEncoder;
+	const StreamCodec codec;
+	const DiaryHdrCapture hdrCapture;
+	const uint64_t maxDiaryBytes;
+	const std::chrono::nanoseconds maxDiaryDuration;
+	const std::filesystem::path ringPath;
+	const std::shared_ptr<DiaryResources> resources;
+	std::unique_ptr<DiaryRing> diaryRing;
+	std::unique_ptr<DiaryWriter> diaryWriter;
+	FrameEncoder frameEncoder;
 
 	CRITICAL_SECTION fileAccessCriticalSection;
+	PipelineStatistics statistics;
 
 	struct FrameData
 	{
 		int width, height, stride;
 		DXGI_FORMAT format;
 		hr_time_point now;
+		int64_t frameIntervalNs;	// the frame rate limiter's when the frame was admitted
 		std::vector<BYTE> data;
 	};
-	moodycamel::BlockingReaderWriterCircularBuffer<FrameData> frames{ 10 };
-	winrt::handle newFrameReadyEvent{ CreateEvent(nullptr, FALSE, FALSE, nullptr) };
-	std::thread frameProcessingThread;
+	FrameRateLimiter frameRateLimiter{ MAX_FRAME_RATE };
+	AdaptiveFrameRate adaptiveFrameRate;
+	moodycamel::BlockingReaderWriterCircularBuffer<FrameData> frames{ FRAME_QUEUE_CAPACITY };
+	FrameBufferPool frameBufferPool;
+
+	// the queued frames are encoded by a task on the shared workers, at most one at a time
+	std::mutex processingMutex;
+	std::condition_variable processingIdle;
+	bool processingScheduled{};
 
 	winrt::com_ptr<IDXGIFactory> dxgiFactory;
 	winrt::com_ptr<ID3D11Device> d3d11Device;
@@ -68,11 +182,18 @@ private:
 	winrt::Windows::Graphics::DirectX::DirectXPixelFormat DxgiPixelFormatToRtPixelFormat(DXGI_FORMAT) const;
 	int GetFormatBytesPerPixel(DXGI_FORMAT) const;
 
-	void OpenNextOutputFile();
-	void WriteRecordedImageToCircularFrameBuffer(const D3D11_MAPPED_SUBRESOURCE&, DXGI_FORMAT, winrt::Windows::Graphics::SizeInt32);
+	void ScheduleFrameProcessing();
+	void ProcessFrames();
+	void EncodeFrame(FrameData&);
+
+	void OpenDiaryRing();
+	void WriteRecordedImageToCircularFrameBuffer(const D3D11_MAPPED_SUBRESOURCE&, DXGI_FORMAT, winrt::Windows::Graphics::SizeInt32, hr_time_point);
+
+	winrt::Windows::Graphics::SizeInt32 GetMaximumSavedFrameSize(const std::vector<DiaryReader>& diaryReaders, int64_t startNs, int64_t endNs,
+		int& frameCount) const;
 
-	winrt::Windows::Graphics::SizeInt32 GetMaximumSavedFrameSize(const std::vector<std::filesystem::path>& partPaths, int& frameCount) const;
+	void CopyFrameToNv12(const DiaryFrame&, BYTE* nv12, winrt::Windows::Graphics::SizeInt32 nv12Size, std::vector<BYTE>& conversionBuffer) const;
 
-	HRESULT WriteTransformOutputSamplesToSink(winrt::com_ptr<IMFTransform>& frameTransform,
-		winrt::com_ptr<IMFSinkWriter>& sinkWriter, MFT_OUTPUT_DATA_BUFFER& mftOutputData) const;
+	HRESULT CreateNv12Sample(const DiaryFrame&, winrt::Windows::Graphics::SizeInt32 nv12Size, int64_t timeNs,
+		std::vector<BYTE>& conversionBuffer, Nv12SamplePool&, winrt::com_ptr<IMFSample>& sample) const;
 };
\ No newline at end of file
@@ -4,6 +4,7 @@
 #define _CRT_SECURE_NO_WARNINGS
 #define _SILENCE_CXX17_CODECVT_HEADER_DEPRECATION_WARNING
 
+#ifdef _WIN32
 #include <windows.h>
 #include <atlbase.h>
 
@@ -33,25 +34,49 @@
 #pragma comment(lib, "mfplat")
 #pragma comment(lib, "mfreadwrite")
 #pragma comment(lib, "mfuuid")
+#endif
 
+#include <cassert>
+#include <cstring>
+#include <algorithm>
 #include <vector>
+#include <deque>
+#include <set>
+#include <array>
+#include <bit>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <filesystem>
 #include <fstream>
 #include <codecvt>
 #include <chrono>
 #include <functional>
 #include <span>
+#include <optional>
+#include <utility>
 
 #include "lzma.h"
 
+#ifdef _WIN32
+// vcpkg always provides the optional codecs, other builds define these for the ones they find
+#define DIARY_WITH_ZSTD
+#define DIARY_WITH_LZ4
+#endif
+#ifdef DIARY_WITH_ZSTD
+#include "zstd.h"
+#endif
+#ifdef DIARY_WITH_LZ4
+#include "lz4frame.h"
+#endif
+
+#ifdef _WIN32
+#include "readerwriterqueue/readerwriterqueue.h"
 #include "readerwriterqueue/readerwritercircularbuffer.h"
 
 #include "framework.h"
 
-typedef std::chrono::high_resolution_clock hr_clock;
-typedef std::chrono::time_point<hr_clock> hr_time_point;
-
 extern "C"
 {
 	HRESULT __stdcall CreateDirect3D11DeviceFromDXGIDevice(::IDXGIDevice* dxgiDevice,
@@ -66,6 +91,13 @@ struct __declspec(uuid("A9B3D012-3DF2-4EE3-B8D1-8695F457D3C1"))
 {
 	virtual HRESULT __stdcall GetInterface(GUID const& id, void** object) = 0;
 };
+#else
+// the recording core builds on other platforms too, for the benchmark and the tools
+#include "platform.h"
+#endif
+
+typedef std::chrono::high_resolution_clock hr_clock;
+typedef std::chrono::time_point<hr_clock> hr_time_point;
 
 static int roundUp(int numToRound, int multiple)
 {
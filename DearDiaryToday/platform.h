@@ -0,0 +1,32 @@
+#pragma once
+
+// the subset of the Windows types the recording core uses, for building it outside of Windows
+
+#include <cstdint>
+#include <cstdlib>
+
+typedef uint8_t BYTE;
+typedef int32_t HRESULT;
+
+#define S_OK ((HRESULT)0L)
+#define S_FALSE ((HRESULT)1L)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+#define ERROR_FILE_TOO_LARGE 223L
+#define HRESULT_FROM_WIN32(x) ((HRESULT)(x) <= 0 ? (HRESULT)(x) : (HRESULT)(((x) & 0x0000FFFF) | (7 << 16) | 0x80000000))
+
+#define __stdcall
+
+// values match dxgiformat.h, they're stored in the diary files
+enum DXGI_FORMAT : uint32_t
+{
+	DXGI_FORMAT_UNKNOWN = 0,
+	DXGI_FORMAT_R16G16B16A16_FLOAT = 10,
+	DXGI_FORMAT_R8G8B8A8_UNORM = 28,
+	DXGI_FORMAT_B8G8R8A8_UNORM = 87,
+	DXGI_FORMAT_NV12 = 103,
+};
@@ -0,0 +1,149 @@
+#include "pch.h"
+#include "SyntheticFrames.h"
+
+using namespace std;
+
+void SyntheticFrame::Resize(int newWidth, int newHeight)
+{
+	if (width == newWidth && height == newHeight)
+		return;
+
+	width = newWidth;
+	height = newHeight;
+	stride = roundUp(width * 4, 256);
+	data.assign(static_cast<size_t>(stride) * height, 0);
+}
+
+namespace
+{
+	constexpr int GLYPH_WIDTH = 7, GLYPH_HEIGHT = 14, LINE_HEIGHT = 18;
+
+	uint32_t Hash(uint32_t x)
+	{
+		x ^= x >> 16;
+		x *= 0x7FEB352DU;
+		x ^= x >> 15;
+		x *= 0x846CA68BU;
+		x ^= x >> 16;
+		return x;
+	}
+
+	void FillRect(SyntheticFrame& frame, int x, int y, int width, int height, uint32_t color)
+	{
+		auto x0 = clamp(x, 0, frame.width), x1 = clamp(x + width, 0, frame.width);
+		auto y0 = clamp(y, 0, frame.height), y1 = clamp(y + height, 0, frame.height);
+		for (auto row = y0; row < y1; ++row)
+			fill_n(reinterpret_cast<uint32_t*>(frame.data.data() + static_cast<size_t>(row) * frame.stride) + x0, x1 - x0, color);
+	}
+
+	// blocky made up glyphs, enough to look like text to the encoder
+	void DrawGlyphs(SyntheticFrame& frame, int x, int y, uint32_t seed, int length, uint32_t color)
+	{
+		for (int i = 0; i < length; ++i, x += GLYPH_WIDTH + 1)
+		{
+			auto glyph = Hash(seed * 131 + i);
+			if (glyph % 7 == 0)
+				continue; // a space
+
+			for (int gy = 0; gy < GLYPH_HEIGHT; gy += 2)
+				for (int gx = 0; gx < GLYPH_WIDTH; gx += 2)
+					if (Hash(glyph + gy * GLYPH_WIDTH + gx) & 1)
+						FillRect(frame, x + gx, y + gy, 2, 2, color);
+		}
+	}
+
+	void DrawTextLine(SyntheticFrame& frame, int x, int y, int width, uint32_t line, uint32_t color)
+	{
+		auto length = static_cast<int>(Hash(line) % (width / (GLYPH_WIDTH + 1) + 1));
+		DrawGlyphs(frame, x, y, line, length, color);
+	}
+
+	// a typical application window: title bar, sidebar, toolbar and a document of text
+	void DrawApplication(SyntheticFrame& frame, int n)
+	{
+		FillRect(frame, 0, 0, frame.width, frame.height, 0xFFF3F3F3);
+		FillRect(frame, 0, 0, frame.width, 32, 0xFF2B579A);
+		DrawGlyphs(frame, 12, 9, 1, 24, 0xFFFFFFFF);
+		FillRect(frame, 0, 32, frame.width, 40, 0xFFE1E1E1);
+		for (int button = 0; button < 12; ++button)
+			FillRect(frame, 8 + button * 36, 38, 28, 28, 0xFFB0B0B0 + button * 0x000A0A0A);
+
+		auto sidebarWidth = min(260, frame.width / 4);
+		FillRect(frame, 0, 72, sidebarWidth, frame.height - 72, 0xFFFAFAFA);
+		for (int item = 0; 72 + 8 + item * LINE_HEIGHT < frame.height; ++item)
+			DrawTextLine(frame, 12, 80 + item * LINE_HEIGHT, sidebarWidth - 24, 1000 + item, 0xFF404040);
+
+		for (int line = 0; 88 + line * LINE_HEIGHT < frame.height - 24; ++line)
+			DrawTextLine(frame, sidebarWidth + 24, 88 + line * LINE_HEIGHT, frame.width - sidebarWidth - 48, line, 0xFF202020);
+
+		// status bar clock ticking every second, and a blinking caret
+		FillRect(frame, 0, frame.height - 24, frame.width, 24, 0xFF2B579A);
+		DrawGlyphs(frame, frame.width - 80, frame.height - 19, 5000 + n / 30, 8, 0xFFFFFFFF);
+		if (n / 15 % 2 == 0)
+			FillRect(frame, sidebarWidth + 200, 88, 2, GLYPH_HEIGHT, 0xFF000000);
+	}
+
+	void DrawScrollingText(SyntheticFrame& frame, int n)
+	{
+		DrawApplication(frame, n);
+
+		// the document scrolls a few pixels every frame, like a log view that's being followed
+		auto sidebarWidth = min(260, frame.width / 4);
+		auto top = 72, bottom = frame.height - 24;
+		FillRect(frame, sidebarWidth, top, frame.width - sidebarWidth, bottom - top, 0xFFFFFFFF);
+
+		auto scroll = n * 3;
+		for (auto y = top - scroll % LINE_HEIGHT; y < bottom; y += LINE_HEIGHT)
+		{
+			auto line = static_cast<uint32_t>((y - top + scroll) / LINE_HEIGHT);
+			if (y >= top && y + GLYPH_HEIGHT <= bottom)
+				DrawTextLine(frame, sidebarWidth + 24, y, frame.width - sidebarWidth - 48, line, 0xFF202020);
+		}
+	}
+
+	void DrawVideoRegion(SyntheticFrame& frame, int n)
+	{
+		DrawApplication(frame, n);
+
+		// a playing video in the middle of the window, every pixel changes every frame
+		auto videoWidth = min(640, frame.width / 2), videoHeight = min(360, frame.height / 2);
+		auto x0 = (frame.width - videoWidth) / 2, y0 = (frame.height - videoHeight) / 2;
+		for (int y = 0; y < videoHeight; ++y)
+		{
+			auto row = reinterpret_cast<uint32_t*>(frame.data.data() + static_cast<size_t>(y0 + y) * frame.stride) + x0;
+			for (int x = 0; x < videoWidth; ++x)
+			{
+				auto noise = Hash((n * videoHeight + y) * videoWidth + x) & 0x0F;
+				auto r = static_cast<uint32_t>((x + n * 4) & 0xFF) ^ noise;
+				auto g = static_cast<uint32_t>((y + n * 2) & 0xFF) ^ noise;
+				auto b = static_cast<uint32_t>(((x + y) / 2 + n * 3) & 0xFF) ^ noise;
+				row[x] = 0xFF000000 | r << 16 | g << 8 | b;
+			}
+		}
+	}
+}
+
+vector<SyntheticScenario> GetSyntheticScenarios(int width, int height)
+{
+	return {
+		{ "static-ui", [=](SyntheticFrame& frame, int n) {
+			frame.Resize(width, height);
+			DrawApplication(frame, n);
+		} },
+		{ "scrolling-text", [=](SyntheticFrame& frame, int n) {
+			frame.Resize(width, height);
+			DrawScrollingText(frame, n);
+		} },
+		{ "video-region", [=](SyntheticFrame& frame, int n) {
+			frame.Resize(width, height);
+			DrawVideoRegion(frame, n);
+		} },
+		{ "resolution-changes", [=](SyntheticFrame& frame, int n) {
+			// the window gets resized every 20 frames, including to odd sizes
+			static constexpr array<pair<int, int>, 4> scales{ { { 4, 4 }, { 3, 3 }, { 4, 3 }, { 3, 4 } } };
+			auto [scaleX, scaleY] = scales[n / 20 % scales.size()];
+			frame.Resize(width * scaleX / 4 | 1, height * scaleY / 4 | 1);
+			DrawApplication(frame, n);
+		} },
+	};
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// a top-down BGRA frame laid out like a mapped staging texture, rows padded to the usual 256 byte pitch
+struct SyntheticFrame
+{
+	int width{}, height{}, stride{};
+	std::vector<BYTE> data;
+
+	void Resize(int width, int height);
+	size_t GetPixelDataSize() const { return static_cast<size_t>(width) * height * 4; }
+};
+
+// renders frame number n of a scenario into the frame, resizing it as needed
+struct SyntheticScenario
+{
+	const char* name;
+	std::function<void(SyntheticFrame&, int n)> render;
+};
+
+std::vector<SyntheticScenario> GetSyntheticScenarios(int width, int height);
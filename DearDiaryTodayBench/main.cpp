@@ -0,0 +1,375 @@
+#include "pch.h"
+#include "SyntheticFrames.h"
+#include "FrameEncoder.h"
+#include "DiaryReader.h"
+#include "ColorConverter.h"
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+using namespace std;
+
+namespace
+{
+	// the frames are timestamped as if they were captured at this rate
+	constexpr int CAPTURE_FRAME_RATE = 30;
+
+	struct Options
+	{
+		int width = 1920, height = 1080;
+		int frames = 120;
+		size_t threads = thread::hardware_concurrency();
+		string scenario;
+		StreamCodec codec;
+		bool nv12{};
+		DiaryHdrCapture hdr{};
+		uint64_t ringBytes{};		// 0 writes a diary file instead
+		double ringSeconds{};
+	};
+
+	constexpr array<const char*, 3> codecNames{ "lzma", "zstd", "lz4" };
+	constexpr array<const char*, 3> hdrNames{ "off", "tonemap", "full" };
+
+	// SDR white on an HDR display at the default SDR brightness, in scRGB
+	constexpr float HDR_SDR_WHITE = 2.5f;
+
+	void Fail(HRESULT hr)
+	{
+		fprintf(stderr, "error 0x%08X\n", static_cast<uint32_t>(hr));
+		exit(1);
+	}
+
+	struct Result
+	{
+		int frames{};
+		hr_clock::duration time{};
+		uint64_t rawBytes{}, compressedBytes{};
+	};
+
+	void Report(const char* scenario, const char* stage, const Result& result)
+	{
+		auto seconds = chrono::duration<double>(result.time).count();
+		printf("%-20s %-14s %8d %12.1f %10.1f %8.2f\n", scenario, stage, result.frames,
+			result.frames / seconds, result.rawBytes / seconds / (1024 * 1024),
+			result.compressedBytes ? static_cast<double>(result.rawBytes) / result.compressedBytes : 0.0);
+	}
+
+	// the half float scRGB a window capture gives on an HDR display, for the positive values of the synthetic frames
+	uint16_t ToHalf(float value)
+	{
+		if (value <= 0)
+			return 0;
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return static_cast<uint16_t>(((bits >> 23) - 112) << 10 | ((bits >> 13) & 0x3FF));
+	}
+
+	void ConvertToHdr(const SyntheticFrame& frame, vector<BYTE>& hdrFrame)
+	{
+		static const auto halves = [] {
+			array<uint16_t, 256> halves{};
+			for (int i = 0; i < 256; ++i)
+			{
+				auto srgb = i / 255.0;
+				auto linear = srgb <= 0.04045 ? srgb / 12.92 : pow((srgb + 0.055) / 1.055, 2.4);
+				halves[i] = ToHalf(static_cast<float>(linear) * HDR_SDR_WHITE);
+			}
+			return halves;
+			}();
+
+		hdrFrame.resize(static_cast<size_t>(frame.width) * frame.height * 8);
+		auto hdr = reinterpret_cast<uint16_t*>(hdrFrame.data());
+		for (int y = 0; y < frame.height; ++y)
+		{
+			auto bgra = frame.data.data() + static_cast<size_t>(y) * frame.stride;
+			for (int x = 0; x < frame.width; ++x, bgra += 4, hdr += 4)
+			{
+				hdr[0] = halves[bgra[2]];
+				hdr[1] = halves[bgra[1]];
+				hdr[2] = halves[bgra[0]];
+				hdr[3] = ToHalf(1);
+			}
+		}
+	}
+
+	// frame n as decoding the diary must give it back: rendered, then put through the same conversions as when it was recorded
+	struct ExpectedFrame
+	{
+		SyntheticFrame rendered;
+		vector<BYTE> hdr, toneMapped, data;
+		int width{}, height{};
+
+		void Render(const SyntheticScenario& scenario, const Options& options, int n)
+		{
+			scenario.render(rendered, n);
+			width = rendered.width;
+			height = rendered.height;
+			auto bgra = rendered.data.data();
+			auto stride = rendered.stride;
+
+			if (options.hdr != DiaryHdrCapture::Off)
+			{
+				ConvertToHdr(rendered, hdr);
+				if (options.hdr == DiaryHdrCapture::FullPrecision)
+				{
+					data = hdr;
+					return;
+				}
+				toneMapped.resize(static_cast<size_t>(width) * height * 4);
+				ToneMapHalfToBgra(hdr.data(), width * 8, width, toneMapped.data(), 0, height);
+				bgra = toneMapped.data();
+				stride = width * 4;
+			}
+
+			if (options.nv12)
+			{
+				width = roundUp(width, 2);
+				height = roundUp(height, 2);
+				auto layout = GetDiaryPlaneLayout(DXGI_FORMAT_NV12, width, height);
+				data.resize(static_cast<size_t>(layout.width) * layout.height);
+				ConvertBgraToNv12(bgra, stride, rendered.width, rendered.height, data.data(), width, height, 0, height);
+				return;
+			}
+
+			auto rowSize = static_cast<size_t>(width) * 4;
+			data.resize(rowSize * height);
+			for (int y = 0; y < height; ++y)
+				memcpy(data.data() + y * rowSize, bgra + static_cast<size_t>(y) * stride, rowSize);
+		}
+	};
+
+	// the path captured frames take: tile hashing, delta packing and striped compression into a diary file
+	Result BenchmarkDiaryEncode(const SyntheticScenario& scenario, const Options& options, WorkerPool& workers, const filesystem::path& path)
+	{
+		Result result{};
+		SyntheticFrame frame;
+		vector<BYTE> hdrFrame;
+		FrameEncoder encoder(workers, options.nv12, options.hdr == DiaryHdrCapture::FullPrecision);
+		PipelineStatistics statistics;
+		unique_ptr<DiaryRing> ring;
+		unique_ptr<DiaryWriter> writer;
+		if (options.ringBytes)
+		{
+			ring = make_unique<DiaryRing>(path, options.ringBytes,
+				chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double>(options.ringSeconds)), Fail);
+			writer = make_unique<DiaryWriter>(*ring, workers, Fail, options.codec, &statistics);
+		}
+		else
+			writer = make_unique<DiaryWriter>(path, workers, Fail, options.codec, &statistics);
+
+		for (int n = 0; n < options.frames; ++n)
+		{
+			// rendering isn't part of the measurement
+			scenario.render(frame, n);
+			auto timeNs = static_cast<int64_t>(n) * chrono::nanoseconds(1s).count() / CAPTURE_FRAME_RATE;
+
+			auto start = hr_clock::now();
+			if (options.hdr != DiaryHdrCapture::Off)
+			{
+				ConvertToHdr(frame, hdrFrame);
+				start = hr_clock::now();
+				encoder.Encode(*writer, hdrFrame.data(), frame.width, frame.height, frame.width * 8, DXGI_FORMAT_R16G16B16A16_FLOAT, timeNs);
+			}
+			else
+				encoder.Encode(*writer, frame.data.data(), frame.width, frame.height, frame.stride, DXGI_FORMAT_B8G8R8A8_UNORM, timeNs);
+			result.time += hr_clock::now() - start;
+
+			// as captured, half floats are twice the size
+			result.rawBytes += frame.GetPixelDataSize() * (options.hdr != DiaryHdrCapture::Off ? 2 : 1);
+			++result.frames;
+		}
+
+		// closing the file finishes the last block
+		auto start = hr_clock::now();
+		writer.reset();
+		ring.reset();
+		result.time += hr_clock::now() - start;
+
+		result.compressedBytes = statistics.encoderBytesOut;
+		return result;
+	}
+
+	// the export path: reading the block index and reconstructing every frame, through buffered reads or a mapping of the file.
+	// Every frame is checked against the one that was recorded
+	Result BenchmarkDiaryDecode(const SyntheticScenario& scenario, const Options& options, const filesystem::path& path, WorkerPool& workers,
+		DiaryInputMode mode)
+	{
+		Result result{};
+		ExpectedFrame expected;
+		hr_clock::duration checkTime{};
+		auto start = hr_clock::now();
+
+		DiaryReader reader(path, mode);
+		for (size_t block = 0; block < reader.GetBlocks().size(); ++block)
+		{
+			result.compressedBytes += reader.GetBlocks()[block].header.compressedSize;
+			DiaryBlockReader blockReader(reader, block, Fail, &workers);
+			while (blockReader.ReadFrame())
+			{
+				auto& frame = blockReader.GetFrame();
+				result.rawBytes += frame.data.size();
+				++result.frames;
+
+				// rendering and comparing isn't part of the measurement. The ring can have dropped the first frames,
+				// so they're matched by timestamp
+				auto checkStart = hr_clock::now();
+				auto n = static_cast<int>((frame.timeNs * CAPTURE_FRAME_RATE + chrono::nanoseconds(1s).count() / 2) / chrono::nanoseconds(1s).count());
+				expected.Render(scenario, options, n);
+				if (frame.width != expected.width || frame.height != expected.height || frame.bottomUp || frame.data.size() != expected.data.size()
+					|| !equal(frame.data.begin(), frame.data.end(), expected.data.begin()))
+				{
+					fprintf(stderr, "%s: frame %d doesn't decode to what was recorded\n", scenario.name, n);
+					Fail(E_FAIL);
+				}
+				checkTime += hr_clock::now() - checkStart;
+			}
+		}
+
+		result.time = hr_clock::now() - start - checkTime;
+		return result;
+	}
+
+	// the codec alone on whole frames, one stream per key frame interval, as a baseline for the diary encoding
+	Result BenchmarkStreamEncode(const SyntheticScenario& scenario, const Options& options, vector<string>& streams)
+	{
+		Result result{};
+		SyntheticFrame frame;
+		auto encoder = StreamEncoder::Create(options.codec, Fail);
+
+		for (int n = 0; n < options.frames; ++n)
+		{
+			scenario.render(frame, n);
+
+			auto start = hr_clock::now();
+			for (int y = 0; y < frame.height; ++y)
+				encoder->Encode(span{ frame.data.data() + static_cast<size_t>(y) * frame.stride, static_cast<size_t>(frame.width) * 4 });
+			if ((n + 1) % KEY_FRAME_INTERVAL == 0 || n + 1 == options.frames)
+			{
+				auto stream = encoder->Finish();
+				streams.emplace_back(reinterpret_cast<const char*>(stream.data()), stream.size());
+				result.compressedBytes += stream.size();
+			}
+			result.time += hr_clock::now() - start;
+
+			result.rawBytes += frame.GetPixelDataSize();
+			++result.frames;
+		}
+		return result;
+	}
+
+	Result BenchmarkStreamDecode(const vector<string>& streams, const Result& encoded, const Options& options)
+	{
+		Result result{ encoded.frames, {}, encoded.rawBytes, encoded.compressedBytes };
+		vector<BYTE> buffer(1024 * 1024);
+
+		auto start = hr_clock::now();
+		uint64_t decodedBytes{};
+		for (auto& stream : streams)
+		{
+			auto decoder = StreamDecoder::Create(options.codec.codec, make_unique<istringstream>(stream), Fail);
+			while (!decoder->IsEof())
+				decodedBytes += decoder->Decode(span{ buffer });
+		}
+		result.time = hr_clock::now() - start;
+
+		if (decodedBytes != encoded.rawBytes)
+			Fail(E_FAIL);
+		return result;
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			string_view arg = argv[i];
+			auto hasValue = i + 1 < argc;
+			if (arg == "--frames" && hasValue)
+				options.frames = atoi(argv[++i]);
+			else if (arg == "--width" && hasValue)
+				options.width = atoi(argv[++i]);
+			else if (arg == "--height" && hasValue)
+				options.height = atoi(argv[++i]);
+			else if (arg == "--threads" && hasValue)
+				options.threads = static_cast<size_t>(atoi(argv[++i]));
+			else if (arg == "--scenario" && hasValue)
+				options.scenario = argv[++i];
+			else if (arg == "--codec" && hasValue)
+			{
+				auto codec = find(codecNames.begin(), codecNames.end(), string_view(argv[++i]));
+				if (codec == codecNames.end())
+					return false;
+				options.codec.codec = static_cast<DiaryCodec>(codec - codecNames.begin());
+			}
+			else if (arg == "--level" && hasValue)
+				options.codec.level = atoi(argv[++i]);
+			else if (arg == "--nv12")
+				options.nv12 = true;
+			else if (arg == "--hdr" && hasValue)
+			{
+				auto hdr = find(hdrNames.begin(), hdrNames.end(), string_view(argv[++i]));
+				if (hdr == hdrNames.end())
+					return false;
+				options.hdr = static_cast<DiaryHdrCapture>(hdr - hdrNames.begin());
+			}
+			else if (arg == "--ring" && hasValue)
+				options.ringBytes = static_cast<uint64_t>(atoi(argv[++i])) * 1024 * 1024;
+			else if (arg == "--ring-seconds" && hasValue)
+				options.ringSeconds = atof(argv[++i]);
+			else
+				return false;
+		}
+
+		return options.frames > 0 && options.width > 0 && options.height > 0 && options.threads > 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		fprintf(stderr, "usage: %s [--frames n] [--width w] [--height h] [--threads n] [--scenario name] [--codec lzma|zstd|lz4] [--level n] [--nv12] [--hdr off|tonemap|full] [--ring MB [--ring-seconds s]]\n", argv[0]);
+		return 1;
+	}
+	if (!StreamEncoder::IsSupported(options.codec.codec))
+	{
+		fprintf(stderr, "%s isn't supported by this build\n", codecNames[static_cast<size_t>(options.codec.codec)]);
+		return 1;
+	}
+
+	// the pool counts the calling thread as one of its threads
+	WorkerPool workers(options.threads - 1);
+	auto path = filesystem::temp_directory_path() / "deardiarytoday_bench.dat";
+
+	printf("%dx%d %s, HDR %s, %d frames, %zu threads, %s level %d\n\n", options.width, options.height, options.nv12 ? "NV12" : "BGRA",
+		hdrNames[static_cast<size_t>(options.hdr)], options.frames, workers.GetThreadCount(), codecNames[static_cast<size_t>(options.codec.codec)], options.codec.level);
+	printf("%-20s %-14s %8s %12s %10s %8s\n", "scenario", "stage", "frames", "frames/s", "MB/s", "ratio");
+
+	auto found = false;
+	for (auto& scenario : GetSyntheticScenarios(options.width, options.height))
+	{
+		if (!options.scenario.empty() && options.scenario != scenario.name)
+			continue;
+		found = true;
+
+		Report(scenario.name, "diary-encode", BenchmarkDiaryEncode(scenario, options, workers, path));
+		Report(scenario.name, "diary-decode", BenchmarkDiaryDecode(scenario, options, path, workers, DiaryInputMode::Buffered));
+		Report(scenario.name, "diary-mapped", BenchmarkDiaryDecode(scenario, options, path, workers, DiaryInputMode::Mapped));
+
+		vector<string> streams;
+		auto encoded = BenchmarkStreamEncode(scenario, options, streams);
+		Report(scenario.name, "stream-encode", encoded);
+		Report(scenario.name, "stream-decode", BenchmarkStreamDecode(streams, encoded, options));
+	}
+
+	error_code ec;
+	filesystem::remove(path, ec);
+
+	if (!found)
+	{
+		fprintf(stderr, "unknown scenario %s\n", options.scenario.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -10,15 +10,15 @@ namespace DearDiaryTodayCs;
 public static partial class DearDiaryToday
 {
     [UnmanagedFunctionPointer(CallingConvention.StdCall)]
-    delegate void ErrorCallback(HRESULT hr);
+    internal delegate void ErrorCallback(HRESULT hr);
     
     [DllImport("deardiarytoday.dll", EntryPoint = "InitializeDiary", CallingConvention = CallingConvention.StdCall)]
-    static extern bool RawInitializeDiary(ErrorCallback errorFunc);
+    static extern bool RawInitializeDiary(ErrorCallback errorFunc, ref DiaryOptions options);
 
     [DllImport("deardiarytoday.dll", EntryPoint = "StartDiary", CallingConvention = CallingConvention.StdCall)]
     static extern void RawStartDiary(HWND hWnd);
 
-    static readonly ErrorCallback errorCallback = hr =>
+    internal static readonly ErrorCallback errorCallback = hr =>
     {
         if (!hr.Succeeded)
             throw new InvalidOperationException($"DearDiaryToday error with HRESULT: {hr}");
@@ -29,10 +29,11 @@ public static partial class DearDiaryToday
     /// and optionally can be saved to a video file before starting a new recording.
     /// </summary>
     /// <returns><see langword="true"/> if a dirty recording was saved.</returns>
-    public static async Task<bool> StartDiary(IntPtr hWnd, Func<Task<string?>>? exportOnDirtyAction = null)
+    public static async Task<bool> StartDiary(IntPtr hWnd, Func<Task<string?>>? exportOnDirtyAction = null, DiaryOptions? options = null)
     {
         var dirty = false;
-        if (RawInitializeDiary(errorCallback) && exportOnDirtyAction is not null
+        var rawOptions = options ?? new();
+        if (RawInitializeDiary(errorCallback, ref rawOptions) && exportOnDirtyAction is not null
             && await exportOnDirtyAction() is { } exportVideoFileName)
         {
             await ExportDiaryVideo(exportVideoFileName);
@@ -45,10 +46,16 @@ public static partial class DearDiaryToday
     }
 
     [UnmanagedFunctionPointer(CallingConvention.StdCall)]
-    delegate void ExportDiaryVideoCompletion(float percentDone, IntPtr arg);
+    internal delegate void ExportDiaryVideoCompletion(float percentDone, IntPtr arg);
 
-    [DllImport("deardiarytoday.dll", EntryPoint = "ExportDiaryVideo", CallingConvention = CallingConvention.StdCall)]
-    static extern void RawExportDiaryVideo([MarshalAs(UnmanagedType.LPWStr)] string outputFileName,
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct DiaryExportRange
+    {
+        public double StartSeconds, EndSeconds;
+    }
+
+    [DllImport("deardiarytoday.dll", EntryPoint = "ExportDiaryVideoRange", CallingConvention = CallingConvention.StdCall)]
+    static extern void RawExportDiaryVideoRange([MarshalAs(UnmanagedType.LPWStr)] string outputFileName, ref DiaryExportRange range,
         ExportDiaryVideoCompletion completion, IntPtr completionArg);
 
     static readonly ConcurrentDictionary<int, (TaskCompletionSource<bool> tcs, Action<float>? progress)> exportDiaryVideoTCS = [];
@@ -64,23 +71,49 @@ public static partial class DearDiaryToday
     };
 
     /// <summary>
-    /// Saves the current diary recording to a video file, and resets the recording buffers.
+    /// Saves the current diary recording to a video file. Recording carries on undisturbed, and the exported part stays in the diary.
+    /// </summary>
+    public static Task ExportDiaryVideo(string outputFileName, Action<float>? progress = null) =>
+        ExportDiaryVideo(outputFileName, new DiaryExportRange { StartSeconds = -1 }, progress);
+
+    /// <summary>
+    /// Saves the last <paramref name="duration"/> of the diary recording to a video file. Only that part is decoded,
+    /// so it's quick even with a long diary.
+    /// </summary>
+    public static Task ExportDiaryVideo(string outputFileName, TimeSpan duration, Action<float>? progress = null) =>
+        ExportDiaryVideo(outputFileName, new DiaryExportRange { StartSeconds = duration.TotalSeconds }, progress);
+
+    /// <summary>
+    /// Saves the part of the diary recording between <paramref name="start"/> and <paramref name="end"/> to a video file.
     /// </summary>
-    public static Task ExportDiaryVideo(string outputFileName, Action<float>? progress = null)
+    public static Task ExportDiaryVideo(string outputFileName, DateTime start, DateTime end, Action<float>? progress = null) =>
+        ExportDiaryVideo(outputFileName, GetExportRange(start, end), progress);
+
+    static Task ExportDiaryVideo(string outputFileName, DiaryExportRange range, Action<float>? progress) =>
+        ExportVideo((completion, arg) => RawExportDiaryVideoRange(outputFileName, ref range, completion, arg), progress);
+
+    internal static DiaryExportRange GetExportRange(DateTime start, DateTime end)
+    {
+        var now = DateTime.Now;
+        return new DiaryExportRange
+        {
+            StartSeconds = Math.Max(0, (now - start).TotalSeconds),
+            EndSeconds = Math.Max(0, (now - end).TotalSeconds),
+        };
+    }
+
+    internal static Task ExportVideo(Action<ExportDiaryVideoCompletion, IntPtr> export, Action<float>? progress)
     {
         var tcs = new TaskCompletionSource<bool>();
         var id = Interlocked.Increment(ref nextExportDiaryVideoCompletionId);
         exportDiaryVideoTCS[id] = (tcs, progress);
 
-        new Thread(() =>
-        {
-            RawExportDiaryVideo(outputFileName, exportDiaryVideoCompletion, new(id));
-        }).Start();
+        new Thread(() => export(exportDiaryVideoCompletion, new(id))).Start();
         return tcs.Task;
     }
 
     [UnmanagedFunctionPointer(CallingConvention.StdCall)]
-    delegate void StopDiaryCompletion(IntPtr arg);
+    internal delegate void StopDiaryCompletion(IntPtr arg);
 
     static int nextStopDiaryCompletionId = 0;
     static readonly ConcurrentDictionary<int, TaskCompletionSource<bool>> stopDiaryTCS = [];
@@ -97,13 +130,37 @@ public static partial class DearDiaryToday
     /// <summary>
     /// Stops the diary recording in progress.
     /// </summary>
-    public static Task StopDiary()
+    public static Task StopDiary() => Stop(RawStopDiary);
+
+    internal static Task Stop(Action<StopDiaryCompletion, IntPtr> stop)
     {
         var tcs = new TaskCompletionSource<bool>();
         var id = Interlocked.Increment(ref nextStopDiaryCompletionId);
         stopDiaryTCS[id] = tcs;
 
-        RawStopDiary(stopDiaryCompletion, new(id));
+        stop(stopDiaryCompletion, new(id));
         return tcs.Task;
     }
+
+    [DllImport("deardiarytoday.dll", EntryPoint = "SetDiaryFrameRate", CallingConvention = CallingConvention.StdCall)]
+    static extern void RawSetDiaryFrameRate(double frameRate);
+
+    /// <summary>
+    /// Sets the maximum number of frames recorded per second, 30 by default. Frames over the limit are dropped before
+    /// they're copied. The rate adapts below it, down to <see cref="DiaryOptions.MinFrameRate"/> while the window is idle.
+    /// Can be called at any time, including before <see cref="StartDiary"/>. A value of 0 or less removes the limit.
+    /// </summary>
+    public static void SetFrameRate(double framesPerSecond) => RawSetDiaryFrameRate(framesPerSecond);
+
+    [DllImport("deardiarytoday.dll", EntryPoint = "GetDiaryStatistics", CallingConvention = CallingConvention.StdCall)]
+    static extern void RawGetDiaryStatistics(out DiaryStatistics statistics);
+
+    /// <summary>
+    /// Returns the recording pipeline counters, all zero when no diary is running. Cheap enough to poll.
+    /// </summary>
+    public static DiaryStatistics GetStatistics()
+    {
+        RawGetDiaryStatistics(out var statistics);
+        return statistics;
+    }
 }
@@ -0,0 +1,94 @@
+﻿using System;
+using System.Runtime.InteropServices;
+using System.Threading.Tasks;
+using Windows.Win32.Foundation;
+using static DearDiaryTodayCs.DearDiaryToday;
+
+namespace DearDiaryTodayCs;
+
+/// <summary>
+/// A diary recording a single window. Any number of them can record at once, they share the compression threads
+/// and the memory of the frames waiting to be compressed.
+/// </summary>
+public sealed class Diary
+{
+    [DllImport("deardiarytoday.dll", EntryPoint = "OpenDiary", CallingConvention = CallingConvention.StdCall)]
+    static extern bool RawOpenDiary([MarshalAs(UnmanagedType.LPWStr)] string name, ErrorCallback errorFunc, ref DiaryOptions options,
+        out IntPtr diary);
+
+    [DllImport("deardiarytoday.dll", EntryPoint = "DiaryStart", CallingConvention = CallingConvention.StdCall)]
+    static extern void RawDiaryStart(IntPtr diary, HWND hWnd);
+
+    [DllImport("deardiarytoday.dll", EntryPoint = "DiaryExportVideo", CallingConvention = CallingConvention.StdCall)]
+    static extern void RawDiaryExportVideo(IntPtr diary, [MarshalAs(UnmanagedType.LPWStr)] string outputFileName, ref DiaryExportRange range,
+        ExportDiaryVideoCompletion completion, IntPtr completionArg);
+
+    [DllImport("deardiarytoday.dll", EntryPoint = "DiaryStop", CallingConvention = CallingConvention.StdCall)]
+    static extern void RawDiaryStop(IntPtr diary, StopDiaryCompletion completion, IntPtr completionArg);
+
+    [DllImport("deardiarytoday.dll", EntryPoint = "DiarySetFrameRate", CallingConvention = CallingConvention.StdCall)]
+    static extern void RawDiarySetFrameRate(IntPtr diary, double frameRate);
+
+    [DllImport("deardiarytoday.dll", EntryPoint = "DiaryGetStatistics", CallingConvention = CallingConvention.StdCall)]
+    static extern void RawDiaryGetStatistics(IntPtr diary, out DiaryStatistics statistics);
+
+    readonly IntPtr handle;
+
+    Diary(IntPtr handle) => this.handle = handle;
+
+    /// <summary>
+    /// Starts recording <paramref name="hWnd"/> into the diary called <paramref name="name"/>, which must be unique among
+    /// the diaries recording at once. A diary of the same name left over by a crash can optionally be saved to a video file first.
+    /// </summary>
+    public static async Task<Diary> Start(string name, IntPtr hWnd, Func<Task<string?>>? exportOnDirtyAction = null, DiaryOptions? options = null)
+    {
+        var rawOptions = options ?? new();
+        var dirty = RawOpenDiary(name, errorCallback, ref rawOptions, out var handle);
+        var diary = new Diary(handle);
+        if (dirty && exportOnDirtyAction is not null && await exportOnDirtyAction() is { } exportVideoFileName)
+            await diary.ExportVideo(exportVideoFileName);
+
+        RawDiaryStart(handle, new(hWnd));
+        return diary;
+    }
+
+    /// <summary>
+    /// Saves the diary recording to a video file. Recording carries on undisturbed, and the exported part stays in the diary.
+    /// </summary>
+    public Task ExportVideo(string outputFileName, Action<float>? progress = null) =>
+        ExportVideo(outputFileName, new DiaryExportRange { StartSeconds = -1 }, progress);
+
+    /// <summary>
+    /// Saves the last <paramref name="duration"/> of the diary recording to a video file.
+    /// </summary>
+    public Task ExportVideo(string outputFileName, TimeSpan duration, Action<float>? progress = null) =>
+        ExportVideo(outputFileName, new DiaryExportRange { StartSeconds = duration.TotalSeconds }, progress);
+
+    /// <summary>
+    /// Saves the part of the diary recording between <paramref name="start"/> and <paramref name="end"/> to a video file.
+    /// </summary>
+    public Task ExportVideo(string outputFileName, DateTime start, DateTime end, Action<float>? progress = null) =>
+        ExportVideo(outputFileName, GetExportRange(start, end), progress);
+
+    Task ExportVideo(string outputFileName, DiaryExportRange range, Action<float>? progress) =>
+        DearDiaryToday.ExportVideo((completion, arg) => RawDiaryExportVideo(handle, outputFileName, ref range, completion, arg), progress);
+
+    /// <summary>
+    /// Stops the recording and deletes the diary. The diary can't be used once this is called.
+    /// </summary>
+    public Task Stop() => DearDiaryToday.Stop((completion, arg) => RawDiaryStop(handle, completion, arg));
+
+    /// <summary>
+    /// Sets the maximum number of frames recorded per second, as <see cref="DearDiaryToday.SetFrameRate"/> does for this diary only.
+    /// </summary>
+    public void SetFrameRate(double framesPerSecond) => RawDiarySetFrameRate(handle, framesPerSecond);
+
+    /// <summary>
+    /// Returns this diary's recording pipeline counters. Cheap enough to poll.
+    /// </summary>
+    public DiaryStatistics GetStatistics()
+    {
+        RawDiaryGetStatistics(handle, out var statistics);
+        return statistics;
+    }
+}
@@ -0,0 +1,80 @@
+﻿using System.Runtime.InteropServices;
+
+namespace DearDiaryTodayCs;
+
+/// <summary>
+/// The compression used for the diary files.
+/// </summary>
+public enum DiaryCodec : uint
+{
+    /// <summary>Slowest, and the smallest diaries.</summary>
+    Lzma,
+    /// <summary>Fast, with levels from -7 (fastest) to 22 (smallest).</summary>
+    Zstd,
+    /// <summary>Fastest, with levels from 3 to 12 trading speed for size.</summary>
+    Lz4,
+}
+
+/// <summary>
+/// How windows showing HDR content are captured.
+/// </summary>
+public enum DiaryHdrCapture : uint
+{
+    /// <summary>As the system maps them to SDR.</summary>
+    Off,
+    /// <summary>In full precision, tone mapped to 8 bits per channel before they're recorded. Costs no more to record than SDR.</summary>
+    ToneMapped,
+    /// <summary>In full precision, and recorded as-is. The diaries take twice the data, the exported video is tone mapped.</summary>
+    FullPrecision,
+}
+
+/// <summary>
+/// Recording options, passed to <see cref="DearDiaryToday.StartDiary"/>.
+/// </summary>
+[StructLayout(LayoutKind.Sequential)]
+public struct DiaryOptions
+{
+    public DiaryCodec Codec;
+
+    /// <summary>
+    /// The compression level of the codec, 0 picks the codec's default.
+    /// </summary>
+    public int CodecLevel;
+
+    /// <summary>
+    /// Records the frames as YUV 4:2:0 instead of BGRA. The diaries are smaller and cheaper to record and export,
+    /// at the cost of some color resolution, which the exported video loses anyway.
+    /// </summary>
+    [MarshalAs(UnmanagedType.Bool)]
+    public bool RecordNv12;
+
+    /// <summary>
+    /// The size of the diary on disk, allocated up front. Once it's full the oldest recording is overwritten.
+    /// 0 picks the default of 128 MB.
+    /// </summary>
+    public ulong MaxDiaryBytes;
+
+    /// <summary>
+    /// How many seconds of recording the diary keeps, as long as they fit in <see cref="MaxDiaryBytes"/>.
+    /// 0 picks the default of 20 seconds, a negative value keeps as much as fits.
+    /// </summary>
+    public double MaxDiarySeconds;
+
+    /// <summary>
+    /// The frame rate the recording slows down to while the window is idle. It speeds back up to the rate set by
+    /// <see cref="DearDiaryToday.SetFrameRate"/> as soon as the window changes, and stays lower while the recorder can't keep up.
+    /// 0 picks the default of 2 frames per second, a negative value always records at the maximum rate.
+    /// </summary>
+    public double MinFrameRate;
+
+    /// <summary>
+    /// How windows showing HDR content are captured, off by default.
+    /// </summary>
+    public DiaryHdrCapture HdrCapture;
+
+    /// <summary>
+    /// The memory the frames waiting to be compressed can take, for all the diaries recording at once. Frames are
+    /// dropped past it. Set by the first diary opened while none is, 0 picks the default of 256 MB.
+    /// </summary>
+    public ulong MaxFrameBufferBytes;
+}
\ No newline at end of file
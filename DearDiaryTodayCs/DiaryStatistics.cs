@@ -0,0 +1,56 @@
+﻿using System;
+using System.Runtime.InteropServices;
+
+namespace DearDiaryTodayCs;
+
+/// <summary>
+/// Latency distribution of one stage of the recording pipeline.
+/// </summary>
+[StructLayout(LayoutKind.Sequential)]
+public struct DiaryLatencyHistogram
+{
+    public const int BucketCount = 20;
+
+    public ulong Count;
+    public ulong TotalNs;
+    public ulong MaxNs;
+
+    /// <summary>
+    /// Bucket <c>i</c> counts latencies of at least 2^(i-1) and under 2^i microseconds, bucket 0 those under a
+    /// microsecond and the last bucket everything longer.
+    /// </summary>
+    [MarshalAs(UnmanagedType.ByValArray, SizeConst = BucketCount)]
+    public ulong[] Buckets;
+
+    public readonly TimeSpan Average => Count == 0 ? TimeSpan.Zero : TimeSpan.FromTicks((long)(TotalNs / Count / 100));
+    public readonly TimeSpan Max => TimeSpan.FromTicks((long)(MaxNs / 100));
+}
+
+/// <summary>
+/// Counters of the recording pipeline since the diary was started.
+/// </summary>
+[StructLayout(LayoutKind.Sequential)]
+public struct DiaryStatistics
+{
+    /// <summary>Every frame the capture session delivered.</summary>
+    public ulong FramesCaptured;
+    /// <summary>Frames rejected by the frame rate limiter.</summary>
+    public ulong FramesRateLimited;
+    /// <summary>Frames dropped because the frame queue was full.</summary>
+    public ulong FramesDropped;
+    /// <summary>Frames dropped because the frame buffer pool was out of budget.</summary>
+    public ulong FramesDroppedNoBuffer;
+    /// <summary>Frames lost because their block was larger than the whole diary ring.</summary>
+    public ulong FramesDroppedBlockTooLarge;
+    public ulong FramesEncoded;
+    public ulong QueueDepth;
+    public ulong FrameBufferPoolBytes;
+    public ulong EncoderBytesIn;
+    public ulong EncoderBytesOut;
+    /// <summary>Staging copy, map and copy into the frame queue.</summary>
+    public DiaryLatencyHistogram CopyLatency;
+    /// <summary>Encoding a frame, including finishing and writing blocks.</summary>
+    public DiaryLatencyHistogram EncodeLatency;
+    /// <summary>Handing finished blocks to the thread that writes the diary file.</summary>
+    public DiaryLatencyHistogram WriteLatency;
+}
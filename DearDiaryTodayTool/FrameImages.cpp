@@ -0,0 +1,179 @@
+#include "pch.h"
+#include "FrameImages.h"
+#include "ColorConverter.h"
+
+#ifdef DIARY_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+void ConvertFrameToBgra(const DiaryFrame& frame, vector<BYTE>& bgra)
+{
+	auto width = frame.width, height = frame.height;
+	bgra.resize(static_cast<size_t>(width) * height * 4);
+	if (frame.format == DXGI_FORMAT_NV12)
+	{
+		ConvertNv12ToBgra(frame.data.data(), width, height, bgra.data(), 0, height);
+		return;
+	}
+
+	auto rowSize = static_cast<ptrdiff_t>(width) * GetDiaryFormatBytesPerPixel(frame.format);
+	auto firstRow = frame.bottomUp ? frame.data.data() + (height - 1) * rowSize : frame.data.data();
+	auto stride = frame.bottomUp ? -rowSize : rowSize;
+	if (frame.format == DXGI_FORMAT_R16G16B16A16_FLOAT)
+	{
+		ToneMapHalfToBgra(firstRow, stride, width, bgra.data(), 0, height);
+		return;
+	}
+
+	for (int y = 0; y < height; ++y)
+	{
+		auto source = firstRow + y * stride;
+		auto destination = bgra.data() + static_cast<size_t>(y) * width * 4;
+		if (frame.format == DXGI_FORMAT_B8G8R8A8_UNORM)
+			memcpy(destination, source, static_cast<size_t>(width) * 4);
+		else
+			for (int x = 0; x < width; ++x)
+			{
+				destination[x * 4] = source[x * 4 + 2];
+				destination[x * 4 + 1] = source[x * 4 + 1];
+				destination[x * 4 + 2] = source[x * 4];
+				destination[x * 4 + 3] = source[x * 4 + 3];
+			}
+	}
+}
+
+void ConvertFrameToI420(const DiaryFrame& frame, int width, int height, vector<BYTE>& bgra, vector<BYTE>& i420)
+{
+	// NV12 frames are used as they are, the others are padded to an even size by the conversion
+	auto frameWidth = roundUp(frame.width, 2), frameHeight = roundUp(frame.height, 2);
+	auto nv12Size = static_cast<size_t>(frameWidth) * frameHeight * 3 / 2;
+	const BYTE* nv12;
+	if (frame.format == DXGI_FORMAT_NV12)
+		nv12 = frame.data.data();
+	else
+	{
+		ConvertFrameToBgra(frame, bgra);
+		bgra.resize(static_cast<size_t>(frame.width) * frame.height * 4 + nv12Size);
+		auto converted = bgra.data() + static_cast<size_t>(frame.width) * frame.height * 4;
+		ConvertBgraToNv12(bgra.data(), static_cast<ptrdiff_t>(frame.width) * 4, frame.width, frame.height,
+			converted, frameWidth, frameHeight, 0, frameHeight);
+		nv12 = converted;
+	}
+
+	// cropped to the video if a frame is larger, which only happens with a size given by hand
+	auto copyWidth = min(frameWidth, width), copyHeight = min(frameHeight, height);
+	i420.resize(static_cast<size_t>(width) * height * 3 / 2);
+	auto lumaPlane = i420.data(), uPlane = lumaPlane + static_cast<size_t>(width) * height;
+	auto vPlane = uPlane + static_cast<size_t>(width / 2) * (height / 2);
+	memset(lumaPlane, 16, static_cast<size_t>(width) * height);
+	memset(uPlane, 128, static_cast<size_t>(width / 2) * (height / 2) * 2);
+
+	for (int y = 0; y < copyHeight; ++y)
+		memcpy(lumaPlane + static_cast<size_t>(y) * width, nv12 + static_cast<size_t>(y) * frameWidth, copyWidth);
+	auto uv = nv12 + static_cast<size_t>(frameWidth) * frameHeight;
+	for (int y = 0; y < copyHeight / 2; ++y)
+	{
+		auto uvRow = uv + static_cast<size_t>(y) * frameWidth;
+		auto uRow = uPlane + static_cast<size_t>(y) * (width / 2), vRow = vPlane + static_cast<size_t>(y) * (width / 2);
+		for (int x = 0; x < copyWidth / 2; ++x)
+		{
+			uRow[x] = uvRow[x * 2];
+			vRow[x] = uvRow[x * 2 + 1];
+		}
+	}
+}
+
+namespace
+{
+	void AppendUInt32(vector<BYTE>& data, uint32_t value)
+	{
+		BYTE bytes[]{ static_cast<BYTE>(value >> 24), static_cast<BYTE>(value >> 16), static_cast<BYTE>(value >> 8), static_cast<BYTE>(value) };
+		data.insert(data.end(), begin(bytes), end(bytes));
+	}
+
+	void AppendChunk(vector<BYTE>& png, const char* type, span<const BYTE> data)
+	{
+		AppendUInt32(png, static_cast<uint32_t>(data.size()));
+		auto typeOffset = png.size();
+		png.insert(png.end(), type, type + 4);
+		png.insert(png.end(), data.begin(), data.end());
+		// the same CRC-32 as the diary blocks'
+		AppendUInt32(png, lzma_crc32(png.data() + typeOffset, png.size() - typeOffset, 0));
+	}
+
+	// a zlib stream of the scanlines
+	vector<BYTE> Deflate(const vector<BYTE>& scanlines)
+	{
+#ifdef DIARY_WITH_ZLIB
+		auto size = compressBound(static_cast<uLong>(scanlines.size()));
+		vector<BYTE> deflated(size);
+		if (compress2(deflated.data(), &size, scanlines.data(), static_cast<uLong>(scanlines.size()), Z_BEST_SPEED) != Z_OK)
+			return {};
+		deflated.resize(size);
+		return deflated;
+#else
+		// stored blocks, with the zlib header and the Adler-32 of the data around them
+		vector<BYTE> deflated{ 0x78, 0x01 };
+		constexpr size_t MAX_STORED_BLOCK = 65535;
+		for (size_t offset = 0; offset < scanlines.size() || offset == 0; offset += MAX_STORED_BLOCK)
+		{
+			auto size = min(scanlines.size() - offset, MAX_STORED_BLOCK);
+			auto last = offset + size == scanlines.size();
+			BYTE header[]{ static_cast<BYTE>(last), static_cast<BYTE>(size), static_cast<BYTE>(size >> 8),
+				static_cast<BYTE>(~size), static_cast<BYTE>(~size >> 8) };
+			deflated.insert(deflated.end(), begin(header), end(header));
+			deflated.insert(deflated.end(), scanlines.begin() + offset, scanlines.begin() + offset + size);
+			if (last)
+				break;
+		}
+
+		uint32_t a = 1, b = 0;
+		for (size_t offset = 0; offset < scanlines.size(); offset += 5552)
+		{
+			for (auto i = offset; i < min(offset + 5552, scanlines.size()); ++i)
+				b += a += scanlines[i];
+			a %= 65521;
+			b %= 65521;
+		}
+		AppendUInt32(deflated, b << 16 | a);
+		return deflated;
+#endif
+	}
+}
+
+bool WritePng(const filesystem::path& path, const BYTE* bgra, int width, int height)
+{
+	// every scanline starts with its filter type, none
+	vector<BYTE> scanlines(static_cast<size_t>(width * 3 + 1) * height);
+	for (int y = 0; y < height; ++y)
+	{
+		auto source = bgra + static_cast<size_t>(y) * width * 4;
+		auto destination = scanlines.data() + static_cast<size_t>(y) * (width * 3 + 1);
+		*destination++ = 0;
+		for (int x = 0; x < width; ++x, source += 4, destination += 3)
+		{
+			destination[0] = source[2];
+			destination[1] = source[1];
+			destination[2] = source[0];
+		}
+	}
+
+	auto deflated = Deflate(scanlines);
+	if (deflated.empty())
+		return false;
+
+	vector<BYTE> png{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	vector<BYTE> header;
+	AppendUInt32(header, static_cast<uint32_t>(width));
+	AppendUInt32(header, static_cast<uint32_t>(height));
+	header.insert(header.end(), { 8, 2, 0, 0, 0 });		// 8 bits per channel, RGB, deflate, no filter, no interlace
+	AppendChunk(png, "IHDR", header);
+	AppendChunk(png, "IDAT", deflated);
+	AppendChunk(png, "IEND", {});
+
+	ofstream file(path, ios::binary | ios::out | ios::trunc);
+	file.write(reinterpret_cast<const char*>(png.data()), static_cast<streamsize>(png.size()));
+	return file.good();
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "DiaryReader.h"
+
+// the frame as packed top-down BGRA of its own size, whatever format it was recorded in
+void ConvertFrameToBgra(const DiaryFrame&, std::vector<BYTE>& bgra);
+
+// the frame as planar YUV 4:2:0 of the given even size, in the top left corner with the rest black, like the exported
+// video. The BGRA buffer is scratch space
+void ConvertFrameToI420(const DiaryFrame&, int width, int height, std::vector<BYTE>& bgra, std::vector<BYTE>& i420);
+
+// an RGB PNG of a packed top-down BGRA image
+bool WritePng(const std::filesystem::path&, const BYTE* bgra, int width, int height);
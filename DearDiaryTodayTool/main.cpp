@@ -0,0 +1,388 @@
+#include "pch.h"
+#include "FrameImages.h"
+#include "StreamEncoder.h"
+
+#include <cstdio>
+#include <cinttypes>
+#include <map>
+#include <string>
+#include <tuple>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+	struct Options
+	{
+		string command;
+		vector<filesystem::path> diaries;
+		size_t threads = thread::hardware_concurrency();
+		double startSeconds{}, endSeconds = -1;		// from the first frame, < 0 for the end of the diary
+		int frameRate = 30;
+		filesystem::path outputDirectory = ".";
+	};
+
+	constexpr array<const char*, 3> codecNames{ "lzma", "zstd", "lz4" };
+
+	// the frames that can't be decoded are reported by the commands themselves, this is only the reason
+	void ReportError(HRESULT hr)
+	{
+		fprintf(stderr, "error 0x%08X\n", static_cast<uint32_t>(hr));
+	}
+
+	const char* GetFormatName(uint32_t format)
+	{
+		switch (format)
+		{
+		case DXGI_FORMAT_B8G8R8A8_UNORM: return "BGRA";
+		case DXGI_FORMAT_R8G8B8A8_UNORM: return "RGBA";
+		case DXGI_FORMAT_R16G16B16A16_FLOAT: return "RGBA16F";
+		case DXGI_FORMAT_NV12: return "NV12";
+		default: return "unknown";
+		}
+	}
+
+	const char* GetCodecName(uint16_t codec)
+	{
+		return codec < codecNames.size() ? codecNames[codec] : "unknown";
+	}
+
+	// the range of the diary to decode, in its own timestamps
+	pair<int64_t, int64_t> GetRangeNs(const DiaryReader& reader, const Options& options)
+	{
+		auto& summary = reader.GetSummary();
+		auto startNs = summary.firstFrameTimeNs + static_cast<int64_t>(options.startSeconds * 1e9);
+		auto endNs = options.endSeconds < 0 ? summary.lastFrameTimeNs : summary.firstFrameTimeNs + static_cast<int64_t>(options.endSeconds * 1e9);
+		return { startNs, endNs };
+	}
+
+	bool IsReadable(const DiaryReader& reader, const filesystem::path& path)
+	{
+		if (reader.GetVersion())
+			return true;
+		fprintf(stderr, "%s: not a diary, or nothing was recorded in it\n", path.string().c_str());
+		return false;
+	}
+
+	// the index alone, nothing is decompressed
+	string Describe(const filesystem::path& path)
+	{
+		DiaryReader reader(path);
+		if (!reader.GetVersion())
+			return path.string() + ": not a diary, or nothing was recorded in it\n";
+
+		auto& summary = reader.GetSummary();
+		auto& blocks = reader.GetBlocks();
+		uint64_t compressedBytes{}, rawBytes{};
+		map<tuple<int32_t, int32_t, uint32_t>, uint32_t> sizes;		// frames of each size and format
+		map<uint16_t, uint32_t> codecs;							// blocks of each codec
+		for (auto& block : blocks)
+		{
+			auto& header = block.header;
+			auto layout = GetDiaryPlaneLayout(static_cast<DXGI_FORMAT>(header.format), header.width, header.height);
+			compressedBytes += sizeof(DiaryBlockHeader) + header.compressedSize;
+			rawBytes += static_cast<uint64_t>(layout.width) * layout.height * layout.bytesPerPixel * header.frameCount;
+			sizes[{ header.width, header.height, header.format }] += header.frameCount;
+			++codecs[header.codec];
+		}
+
+		char line[256];
+		string description = path.string() + "\n";
+		auto append = [&](const char* format, auto... values) {
+			snprintf(line, sizeof(line), format, values...);
+			description += line;
+			};
+		append("  version %u%s\n", reader.GetVersion(), reader.IsTruncated() ? ", ends in blocks torn by a crash" : "");
+		append("  %u blocks, %u frames, %.3f s\n", summary.blockCount, summary.frameCount,
+			(summary.lastFrameTimeNs - summary.firstFrameTimeNs) / 1e9);
+		append("  timestamps %" PRId64 " to %" PRId64 " ns\n", summary.firstFrameTimeNs, summary.lastFrameTimeNs);
+		for (auto& [size, frames] : sizes)
+			append("  %dx%d %s: %u frames\n", get<0>(size), get<1>(size), GetFormatName(get<2>(size)), frames);
+		for (auto& [codec, blockCount] : codecs)
+			append("  %s: %u blocks\n", GetCodecName(codec), blockCount);
+		append("  %.1f MB compressed, %.1f MB of frames, ratio %.2f\n", compressedBytes / (1024.0 * 1024), rawBytes / (1024.0 * 1024),
+			compressedBytes ? static_cast<double>(rawBytes) / compressedBytes : 0.0);
+		return description;
+	}
+
+	int Info(const Options& options, WorkerPool& workers)
+	{
+		vector<string> descriptions(options.diaries.size());
+		workers.Run(descriptions.size(), [&](size_t diary) { descriptions[diary] = Describe(options.diaries[diary]); });
+		for (auto& description : descriptions)
+			fputs(description.c_str(), stdout);
+		return 0;
+	}
+
+	struct BlockCheck
+	{
+		bool intact{};
+		uint32_t framesRead{};
+		bool timesMatch{};
+	};
+
+	// decodes every frame of every block, the blocks of all the diaries at once
+	int Verify(const Options& options, WorkerPool& workers)
+	{
+		vector<unique_ptr<DiaryReader>> readers(options.diaries.size());
+		workers.Run(readers.size(), [&](size_t diary) { readers[diary] = make_unique<DiaryReader>(options.diaries[diary]); });
+
+		vector<pair<size_t, size_t>> blocks;		// diary, block
+		vector<vector<BlockCheck>> checks(readers.size());
+		for (size_t diary = 0; diary < readers.size(); ++diary)
+		{
+			checks[diary].resize(readers[diary]->GetBlocks().size());
+			for (size_t block = 0; block < checks[diary].size(); ++block)
+				blocks.emplace_back(diary, block);
+		}
+
+		workers.Run(blocks.size(), [&](size_t index) {
+			auto [diary, block] = blocks[index];
+			auto& reader = *readers[diary];
+			auto& check = checks[diary][block];
+			check.intact = reader.IsBlockIntact(block);
+			if (!StreamEncoder::IsSupported(static_cast<DiaryCodec>(reader.GetBlocks()[block].header.codec)))
+				return;
+
+			DiaryBlockReader blockReader(reader, block, ReportError, &workers);
+			while (blockReader.ReadFrame())
+				++check.framesRead;
+			check.timesMatch = check.framesRead && blockReader.GetFrame().timeNs == reader.GetBlocks()[block].header.lastFrameTimeNs;
+			});
+
+		auto damaged = false;
+		for (size_t diary = 0; diary < readers.size(); ++diary)
+		{
+			auto& reader = *readers[diary];
+			auto path = options.diaries[diary].string();
+			if (!IsReadable(reader, options.diaries[diary]))
+			{
+				damaged = true;
+				continue;
+			}
+
+			auto diaryDamaged = reader.IsTruncated();
+			uint32_t frames{};
+			for (size_t block = 0; block < checks[diary].size(); ++block)
+			{
+				auto& header = reader.GetBlocks()[block].header;
+				auto& check = checks[diary][block];
+				frames += check.framesRead;
+				if (!check.intact)
+					printf("%s: block %zu fails its checksum\n", path.c_str(), block);
+				if (!StreamEncoder::IsSupported(static_cast<DiaryCodec>(header.codec)))
+					printf("%s: block %zu is %s, which this build can't decode\n", path.c_str(), block, GetCodecName(header.codec));
+				else if (check.framesRead != header.frameCount || !check.timesMatch)
+					printf("%s: block %zu decoded %u of %u frames\n", path.c_str(), block, check.framesRead, header.frameCount);
+				else if (check.intact)
+					continue;
+				diaryDamaged = true;
+			}
+
+			if (reader.IsTruncated())
+				printf("%s: ends in blocks torn by a crash\n", path.c_str());
+			printf("%s: %s, %zu blocks, %u frames decoded\n", path.c_str(), diaryDamaged ? "damaged" : "ok", checks[diary].size(), frames);
+			damaged |= diaryDamaged;
+		}
+		return damaged ? 1 : 0;
+	}
+
+	// every frame in the range as a PNG named after its index in the diary, the blocks decoded in parallel
+	int Dump(const Options& options, WorkerPool& workers)
+	{
+		DiaryReader reader(options.diaries[0]);
+		if (!IsReadable(reader, options.diaries[0]))
+			return 1;
+
+		auto [startNs, endNs] = GetRangeNs(reader, options);
+		auto [firstBlock, endBlock] = reader.FindBlocks(startNs, endNs);
+		vector<uint32_t> firstFrames(reader.GetBlocks().size() + 1);
+		for (size_t block = 0; block < reader.GetBlocks().size(); ++block)
+			firstFrames[block + 1] = firstFrames[block] + reader.GetBlocks()[block].header.frameCount;
+
+		filesystem::create_directories(options.outputDirectory);
+		atomic<uint32_t> written{};
+		atomic<bool> failed{};
+		workers.Run(endBlock - firstBlock, [&](size_t index) {
+			auto block = firstBlock + index;
+			DiaryBlockReader blockReader(reader, block, ReportError, &workers);
+			vector<BYTE> bgra;
+			char name[32];
+			for (auto frameIndex = firstFrames[block]; blockReader.ReadFrame(); ++frameIndex)
+			{
+				auto& frame = blockReader.GetFrame();
+				if (frame.timeNs < startNs)
+					continue;
+				if (frame.timeNs > endNs)
+					break;
+
+				ConvertFrameToBgra(frame, bgra);
+				snprintf(name, sizeof(name), "frame%06u.png", frameIndex);
+				if (WritePng(options.outputDirectory / name, bgra.data(), frame.width, frame.height))
+					++written;
+				else
+					failed = true;
+			}
+			});
+
+		fprintf(stderr, "%u frames written to %s\n", written.load(), options.outputDirectory.string().c_str());
+		return failed ? 1 : 0;
+	}
+
+	// the diary resampled to a constant frame rate as YUV4MPEG2 on stdout. Blocks are decoded in parallel a batch
+	// at a time, each into the video frames that fall between its first frame and the next block's, and written
+	// out in order
+	int Y4m(const Options& options, WorkerPool& workers)
+	{
+		DiaryReader reader(options.diaries[0]);
+		if (!IsReadable(reader, options.diaries[0]))
+			return 1;
+
+		auto& blocks = reader.GetBlocks();
+		auto& summary = reader.GetSummary();
+		auto [startNs, endNs] = GetRangeNs(reader, options);
+		auto [firstBlock, endBlock] = reader.FindBlocks(startNs, endNs);
+		if (firstBlock == endBlock)
+		{
+			fprintf(stderr, "%s: no frames in the range\n", options.diaries[0].string().c_str());
+			return 1;
+		}
+		startNs = max(startNs, blocks[firstBlock].header.firstFrameTimeNs);
+
+		// the last frame is shown for one video frame
+		auto frameRate = options.frameRate;
+		auto videoEndNs = min(endNs, summary.lastFrameTimeNs) + 1'000'000'000 / frameRate;
+		auto getFrameTimeNs = [&](int64_t frame) { return startNs + frame * 1'000'000'000 / frameRate; };
+		auto getFirstFrameAt = [&](int64_t timeNs) {
+			auto frame = max<int64_t>((timeNs - startNs) * frameRate / 1'000'000'000, 0);
+			while (getFrameTimeNs(frame) < timeNs)
+				++frame;
+			return frame;
+			};
+
+		// the video is as large as the largest frame, NV12 needs an even size
+		auto width = roundUp(summary.maxWidth, 2), height = roundUp(summary.maxHeight, 2);
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		printf("YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, frameRate);
+
+		auto batchSize = workers.GetThreadCount();
+		vector<vector<vector<BYTE>>> batch(batchSize);
+		int64_t videoFrames{};
+		for (auto batchBlock = firstBlock; batchBlock < endBlock; batchBlock += batchSize)
+		{
+			auto count = min(batchSize, endBlock - batchBlock);
+			workers.Run(count, [&](size_t index) {
+				auto block = batchBlock + index;
+				auto blockEndNs = block + 1 < blocks.size() ? min(blocks[block + 1].header.firstFrameTimeNs, videoEndNs) : videoEndNs;
+				auto& videoFramesOut = batch[index];
+				videoFramesOut.clear();
+
+				// each video frame shows the last diary frame at or before its time
+				DiaryBlockReader blockReader(reader, block, ReportError, &workers);
+				DiaryFrame shown;
+				vector<BYTE> bgra;
+				auto videoFrame = getFirstFrameAt(max(startNs, blocks[block].header.firstFrameTimeNs));
+				auto emitUntil = [&](int64_t timeNs) {
+					for (; getFrameTimeNs(videoFrame) < timeNs && getFrameTimeNs(videoFrame) < blockEndNs; ++videoFrame)
+					{
+						videoFramesOut.emplace_back();
+						ConvertFrameToI420(shown, width, height, bgra, videoFramesOut.back());
+					}
+					};
+				while (blockReader.ReadFrame())
+				{
+					auto& frame = blockReader.GetFrame();
+					if (!shown.data.empty())
+						emitUntil(frame.timeNs);
+					shown.width = frame.width;
+					shown.height = frame.height;
+					shown.format = frame.format;
+					shown.bottomUp = frame.bottomUp;
+					shown.data.assign(frame.data.begin(), frame.data.end());
+				}
+				if (!shown.data.empty())
+					emitUntil(blockEndNs);
+				});
+
+			for (size_t index = 0; index < count; ++index)
+				for (auto& videoFrame : batch[index])
+				{
+					fputs("FRAME\n", stdout);
+					fwrite(videoFrame.data(), 1, videoFrame.size(), stdout);
+					++videoFrames;
+				}
+		}
+
+		fflush(stdout);
+		fprintf(stderr, "%" PRId64 " frames at %d fps, %dx%d\n", videoFrames, frameRate, width, height);
+		return ferror(stdout) ? 1 : 0;
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		if (argc < 2)
+			return false;
+		options.command = argv[1];
+
+		for (int i = 2; i < argc; ++i)
+		{
+			string_view arg = argv[i];
+			auto hasValue = i + 1 < argc;
+			if (arg == "--threads" && hasValue)
+				options.threads = static_cast<size_t>(atoi(argv[++i]));
+			else if (arg == "--start" && hasValue)
+				options.startSeconds = atof(argv[++i]);
+			else if (arg == "--end" && hasValue)
+				options.endSeconds = atof(argv[++i]);
+			else if (arg == "--fps" && hasValue)
+				options.frameRate = atoi(argv[++i]);
+			else if (arg == "--out" && hasValue)
+				options.outputDirectory = argv[++i];
+			else if (arg.starts_with("--"))
+				return false;
+			else
+				options.diaries.emplace_back(arg);
+		}
+
+		// dump and y4m write a single diary
+		auto singleDiary = options.command == "dump" || options.command == "y4m";
+		return !options.diaries.empty() && (!singleDiary || options.diaries.size() == 1) && options.threads > 0 && options.frameRate > 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		fprintf(stderr,
+			"usage: %s info diary...                 blocks, frames, sizes, timestamps and compression\n"
+			"       %s verify diary...               decodes every frame, exits with 1 if any diary is damaged\n"
+			"       %s dump [--out dir] diary        every frame as a PNG\n"
+			"       %s y4m [--fps n] diary           the video as YUV4MPEG2 on stdout, for ffmpeg\n"
+			"options: --threads n, and --start s and --end s in seconds from the first frame for dump and y4m\n",
+			argv[0], argv[0], argv[0], argv[0]);
+		return 2;
+	}
+
+	// the pool counts the calling thread as one of its threads
+	WorkerPool workers(options.threads - 1);
+	if (options.command == "info")
+		return Info(options, workers);
+	if (options.command == "verify")
+		return Verify(options, workers);
+	if (options.command == "dump")
+		return Dump(options, workers);
+	if (options.command == "y4m")
+		return Y4m(options, workers);
+
+	fprintf(stderr, "unknown command %s\n", options.command.c_str());
+	return 2;
+}